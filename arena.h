@@ -1,79 +1,232 @@
-// Simple arena allocator - v1.2
+// Simple arena allocator - v2.1
+//
+// Memory comes from a chain of blocks. When the current block is full the
+// next one is twice as large, so an arena can be sized for the common case
+// and still take the occasional outlier. Blocks are kept on reset and rollback
+// and reused by later allocations.
+//
+// Arena_Pool caches reset arenas per thread so leasing one for a request or a
+// connection does not go through malloc. Arenas are kept in power of two size
+// classes and new ones are sized from the footprint of recent leases.
 
 #ifndef ARENA_H_
 #define ARENA_H_
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+
+#ifndef ARENA_ALIGNMENT
+#define ARENA_ALIGNMENT sizeof(void*)
+#endif
+
+#define ARENA_DEFAULT_CAPACITY 0x1000
+#define ARENA_HUGE_PAGE_SIZE 0x200000
+
+// Arena flags
+#define ARENA_HUGE_PAGES 0x01	// Back blocks of ARENA_HUGE_PAGE_SIZE or more with huge pages where supported
+
+typedef struct Arena_Block Arena_Block;
+struct Arena_Block {
+	Arena_Block* next;
+	size_t capacity;
+	unsigned char mapped;
+	_Alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
 
 typedef struct {
-	unsigned char* base;
+	Arena_Block* first;
+	Arena_Block* current;
 	unsigned char* head;
 	unsigned char* last;
 	size_t capacity;
+	unsigned char flags;
 } Arena;
 
 Arena arena_create(size_t capacity);
+Arena arena_create_ex(size_t capacity, unsigned char flags);
 void* arena_alloc(Arena* arena, size_t bytes);
 void* arena_realloc(Arena* arena, void* ptr, size_t current, size_t target);
+// A checkpoint stays valid across blocks until the arena is reset or rolled back past it
 unsigned char* arena_checkpoint(Arena* arena);
-void arena_rollback(Arena* arena, unsigned char* ptr);
+void arena_rollback(Arena* arena, unsigned char* checkpoint);
+// Frees everything at once but keeps the blocks for reuse
+void arena_reset(Arena* arena);
 void arena_destroy(Arena* arena);
+// Bytes handed out so far, counting the unused tail of every full block
+size_t arena_used(const Arena* arena);
+// Frees the blocks past the current one
+void arena_trim(Arena* arena);
+
+#define ARENA_POOL_MIN_CAPACITY 0x1000
+#define ARENA_POOL_CLASSES 8		// 4 KB to 512 KB
+#define ARENA_POOL_MAX_FREE 8		// Cached arenas per size class, bounds the memory a pool keeps after a spike
+
+// Lease scopes, each learns its own footprint
+#define ARENA_POOL_REQUEST 0
+#define ARENA_POOL_CONNECTION 1
+#define ARENA_POOL_SCOPES 2
+
+typedef struct {
+	Arena free[ARENA_POOL_CLASSES][ARENA_POOL_MAX_FREE];
+	unsigned char count[ARENA_POOL_CLASSES];
+	// Moving average of the bytes used per lease
+	size_t footprint[ARENA_POOL_SCOPES];
+} Arena_Pool;
+
+// The calling thread's pool; never share it with another thread
+Arena_Pool* arena_pool_thread(void);
+// Returns an empty arena sized for the scope, capacity 0 if out of memory
+Arena arena_pool_lease(Arena_Pool* pool, unsigned char scope);
+// Records the arena's footprint, then resets and caches it or frees it if its class is full
+void arena_pool_return(Arena_Pool* pool, Arena* arena, unsigned char scope);
+// Frees every cached arena, e.g. when the thread exits
+void arena_pool_destroy(Arena_Pool* pool);
 
 #endif
 
 #ifdef ARENA_IMPLEMENTATION
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#define ARENA_HAS_MMAP
+#endif
+
+static unsigned char* arena_align(unsigned char* ptr)
+{
+	return (unsigned char*)(((uintptr_t)ptr + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1));
+}
+
+static Arena_Block* arena_block_create(size_t capacity, unsigned char flags)
+{
+	size_t size = sizeof(Arena_Block) + capacity;
+	Arena_Block* block = NULL;
+
+#ifdef ARENA_HAS_MMAP
+	if ((flags & ARENA_HUGE_PAGES) && size >= ARENA_HUGE_PAGE_SIZE) {
+		size = (size + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+		void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+			madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+			block = ptr;
+			block->next = NULL;
+			block->capacity = size - sizeof(Arena_Block);
+			block->mapped = 1;
+			return block;
+		}
+		size = sizeof(Arena_Block) + capacity;
+	}
+#endif
+
+	block = malloc(size);
+	if (block == NULL)
+		return NULL;
+
+	block->next = NULL;
+	block->capacity = capacity;
+	block->mapped = 0;
+	return block;
+}
+
+static void arena_block_destroy(Arena_Block* block)
+{
+#ifdef ARENA_HAS_MMAP
+	if (block->mapped) {
+		munmap(block, sizeof(Arena_Block) + block->capacity);
+		return;
+	}
+#endif
+	free(block);
+}
+
+// Moves to the block after the current one, inserting a new one if that is missing or too small
+static Arena_Block* arena_next_block(Arena* arena, size_t bytes)
+{
+	if (bytes > SIZE_MAX / 2 - sizeof(Arena_Block) - ARENA_ALIGNMENT)
+		return NULL;
+
+	size_t needed = bytes + ARENA_ALIGNMENT - 1;
+	Arena_Block* next = arena->current->next;
+	if (next == NULL || next->capacity < needed) {
+		size_t capacity = arena->current->capacity * 2;
+		if (capacity < needed)
+			capacity = needed;
+
+		Arena_Block* block = arena_block_create(capacity, arena->flags);
+		if (block == NULL)
+			return NULL;
+
+		block->next = next;
+		arena->current->next = block;
+		next = block;
+	}
+
+	arena->current = next;
+	return next;
+}
+
 Arena arena_create(size_t capacity)
 {
-	void* ptr = malloc(capacity);
-	if (ptr == NULL)
+	return arena_create_ex(capacity, 0);
+}
+
+Arena arena_create_ex(size_t capacity, unsigned char flags)
+{
+	if (capacity == 0)
+		capacity = ARENA_DEFAULT_CAPACITY;
+
+	Arena_Block* block = arena_block_create(capacity, flags);
+	if (block == NULL)
 		return (Arena) {0};
-	
+
 	return (Arena) {
+		.first = block,
+		.current = block,
+		.head = block->data,
+		.last = NULL,
 		.capacity = capacity,
-		.base = ptr,
-		.head = ptr,
-		.last = ptr
+		.flags = flags
 	};
 }
 
 void* arena_alloc(Arena* arena, size_t bytes)
 {
-	if (arena == NULL || arena->base == NULL || bytes == 0)
+	if (arena == NULL || arena->current == NULL || bytes == 0)
 		return NULL;
 
-	if (bytes > arena->capacity - (arena->head - arena->base))
-		return NULL;
+	Arena_Block* block = arena->current;
+	unsigned char* ptr = arena_align(arena->head);
+	unsigned char* end = block->data + block->capacity;
+	if (ptr > end || bytes > (size_t)(end - ptr)) {
+		block = arena_next_block(arena, bytes);
+		if (block == NULL)
+			return NULL;
+		ptr = arena_align(block->data);
+	}
 
-	arena->last = arena->head;
-	arena->head += bytes;
-	return arena->last;
+	arena->last = ptr;
+	arena->head = ptr + bytes;
+	return ptr;
 }
 
 void* arena_realloc(Arena* arena, void* ptr, size_t current, size_t target)
 {
-	if (arena == NULL || arena->base == NULL || target == 0)
+	if (arena == NULL || arena->current == NULL || target == 0)
 		return NULL;
 
-	size_t bytes_used = arena->head - arena->base;
-	if (ptr == arena->last) {
-		int size_diff = target - current;
-		if (size_diff < 0 || size_diff > arena->capacity - bytes_used)
-			return NULL;
-
-		arena->head += size_diff;
+	// The last allocation is always in the current block and can grow or shrink in place
+	unsigned char* end = arena->current->data + arena->current->capacity;
+	if (ptr != NULL && ptr == arena->last && target <= (size_t)(end - arena->last)) {
+		arena->head = arena->last + target;
 		return ptr;
 	}
 
-	if (target > arena->capacity - (bytes_used))
-		return NULL;
-
-	arena->last = arena->head;
-	arena->head += target;
-	if (ptr != NULL && current > 0)
-		memcpy(arena->last, ptr, current);
-	return arena->last;
+	void* copy = arena_alloc(arena, target);
+	if (copy != NULL && ptr != NULL && current > 0)
+		memcpy(copy, ptr, current < target ? current : target);
+	return copy;
 }
 
 unsigned char* arena_checkpoint(Arena* arena)
@@ -83,14 +236,137 @@ unsigned char* arena_checkpoint(Arena* arena)
 
 void arena_rollback(Arena* arena, unsigned char* checkpoint)
 {
-	if (arena->base >= checkpoint && checkpoint >= arena->base + arena->capacity)
-		arena->head = checkpoint;
+	if (arena == NULL || checkpoint == NULL)
+		return;
+
+	// Blocks up to the current one are in use, in allocation order
+	for (Arena_Block* block = arena->first; block != NULL; block = block->next) {
+		if (block->data <= checkpoint && checkpoint <= block->data + block->capacity) {
+			if (block == arena->current && checkpoint > arena->head)
+				return;
+			arena->current = block;
+			arena->head = checkpoint;
+			arena->last = NULL;
+			return;
+		}
+		if (block == arena->current)
+			return;
+	}
+}
+
+void arena_reset(Arena* arena)
+{
+	if (arena == NULL || arena->first == NULL)
+		return;
+
+	arena->current = arena->first;
+	arena->head = arena->first->data;
+	arena->last = NULL;
+}
+
+void arena_destroy(Arena* arena)
+{
+	if (arena == NULL)
+		return;
+
+	Arena_Block* block = arena->first;
+	while (block != NULL) {
+		Arena_Block* next = block->next;
+		arena_block_destroy(block);
+		block = next;
+	}
+
+	*arena = (Arena) {0};
+}
+
+size_t arena_used(const Arena* arena)
+{
+	if (arena == NULL || arena->current == NULL)
+		return 0;
+
+	size_t used = 0;
+	for (Arena_Block* block = arena->first; block != arena->current; block = block->next)
+		used += block->capacity;
+	return used + (arena->head - arena->current->data);
+}
+
+void arena_trim(Arena* arena)
+{
+	if (arena == NULL || arena->current == NULL)
+		return;
+
+	Arena_Block* block = arena->current->next;
+	arena->current->next = NULL;
+	while (block != NULL) {
+		Arena_Block* next = block->next;
+		arena_block_destroy(block);
+		block = next;
+	}
+}
+
+static _Thread_local Arena_Pool arena_thread_pool;
+
+Arena_Pool* arena_pool_thread(void)
+{
+	return &arena_thread_pool;
+}
+
+// Smallest class whose capacity covers the bytes, or the last class
+static unsigned char arena_pool_class(size_t bytes)
+{
+	unsigned char class = 0;
+	size_t capacity = ARENA_POOL_MIN_CAPACITY;
+	while (class < ARENA_POOL_CLASSES - 1 && capacity < bytes) {
+		capacity <<= 1;
+		class++;
+	}
+	return class;
+}
+
+Arena arena_pool_lease(Arena_Pool* pool, unsigned char scope)
+{
+	// A quarter of headroom over the average keeps most leases in one block
+	size_t footprint = pool->footprint[scope];
+	unsigned char class = arena_pool_class(footprint + footprint / 4);
+
+	// A larger cached arena is still better than a malloc
+	for (unsigned char i = class; i < ARENA_POOL_CLASSES; ++i) {
+		if (pool->count[i])
+			return pool->free[i][--pool->count[i]];
+	}
+
+	return arena_create((size_t)ARENA_POOL_MIN_CAPACITY << class);
+}
+
+void arena_pool_return(Arena_Pool* pool, Arena* arena, unsigned char scope)
+{
+	if (arena == NULL || arena->first == NULL)
+		return;
+
+	// Weighted 1/8 so a single outlier barely moves it
+	size_t used = arena_used(arena);
+	size_t footprint = pool->footprint[scope];
+	pool->footprint[scope] = footprint - footprint / 8 + used / 8;
+
+	arena_reset(arena);
+	arena_trim(arena);
+
+	unsigned char class = arena_pool_class(arena->capacity);
+	if (arena->capacity != (size_t)ARENA_POOL_MIN_CAPACITY << class || pool->count[class] == ARENA_POOL_MAX_FREE) {
+		arena_destroy(arena);
+		return;
+	}
+
+	pool->free[class][pool->count[class]++] = *arena;
+	*arena = (Arena) {0};
 }
 
-void arena_destroy(Arena* arena) 
+void arena_pool_destroy(Arena_Pool* pool)
 {
-	if (arena != NULL && arena->base != NULL)
-		free(arena->base);
+	for (unsigned char i = 0; i < ARENA_POOL_CLASSES; ++i) {
+		while (pool->count[i])
+			arena_destroy(&pool->free[i][--pool->count[i]]);
+	}
 }
 
 #endif
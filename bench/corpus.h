@@ -0,0 +1,15 @@
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include <stddef.h>
+
+typedef struct {
+	const char* name;
+	const char* data;
+	size_t len;
+} Bench_Case;
+
+// Builds the corpus once; large bodies are generated rather than stored
+const Bench_Case* bench_corpus(size_t* count);
+
+#endif
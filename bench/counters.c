@@ -0,0 +1,99 @@
+#include <string.h>
+
+#include "counters.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+static const uint64_t counter_configs[BENCH_COUNTER_COUNT] = {
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_MISSES
+};
+
+int bench_counters_open(Bench_Counters* counters)
+{
+	int count = 0;
+	memset(counters->values, 0, sizeof(counters->values));
+	for (int i = 0; i < BENCH_COUNTER_COUNT; ++i) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = counter_configs[i];
+		attr.disabled = 1;
+		// User space only, which perf_event_paranoid 2 still allows
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		counters->fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		if (counters->fds[i] >= 0)
+			count++;
+	}
+	return count;
+}
+
+void bench_counters_close(Bench_Counters* counters)
+{
+	for (int i = 0; i < BENCH_COUNTER_COUNT; ++i) {
+		if (counters->fds[i] >= 0)
+			close(counters->fds[i]);
+		counters->fds[i] = -1;
+	}
+}
+
+uint8_t bench_counters_available(const Bench_Counters* counters, Bench_Counter counter)
+{
+	return counters->fds[counter] >= 0;
+}
+
+void bench_counters_start(Bench_Counters* counters)
+{
+	for (int i = 0; i < BENCH_COUNTER_COUNT; ++i) {
+		if (counters->fds[i] >= 0) {
+			ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+void bench_counters_stop(Bench_Counters* counters)
+{
+	for (int i = 0; i < BENCH_COUNTER_COUNT; ++i) {
+		counters->values[i] = 0;
+		if (counters->fds[i] < 0)
+			continue;
+		ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counters->fds[i], &counters->values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+			counters->values[i] = 0;
+	}
+}
+#else
+int bench_counters_open(Bench_Counters* counters)
+{
+	memset(counters, 0, sizeof(Bench_Counters));
+	for (int i = 0; i < BENCH_COUNTER_COUNT; ++i)
+		counters->fds[i] = -1;
+	return 0;
+}
+
+void bench_counters_close(Bench_Counters* counters)
+{
+}
+
+uint8_t bench_counters_available(const Bench_Counters* counters, Bench_Counter counter)
+{
+	return 0;
+}
+
+void bench_counters_start(Bench_Counters* counters)
+{
+}
+
+void bench_counters_stop(Bench_Counters* counters)
+{
+}
+#endif
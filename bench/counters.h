@@ -0,0 +1,29 @@
+#ifndef BENCH_COUNTERS_H
+#define BENCH_COUNTERS_H
+
+#include <stdint.h>
+
+// Hardware counters for benchmark runs through perf_event_open (Linux). Counters
+// the kernel or CPU does not offer, e.g. inside most VMs, stay unavailable and
+// read as zero; nothing else depends on them.
+typedef enum {
+	BENCH_INSTRUCTIONS,
+	BENCH_BRANCH_MISSES,
+	BENCH_CACHE_MISSES,
+	BENCH_COUNTER_COUNT
+} Bench_Counter;
+
+typedef struct {
+	int fds[BENCH_COUNTER_COUNT];
+	uint64_t values[BENCH_COUNTER_COUNT];
+} Bench_Counters;
+
+// Returns the number of counters that could be opened
+int bench_counters_open(Bench_Counters* counters);
+void bench_counters_close(Bench_Counters* counters);
+uint8_t bench_counters_available(const Bench_Counters* counters, Bench_Counter counter);
+// Counts the calling thread's user space between start and stop into values
+void bench_counters_start(Bench_Counters* counters);
+void bench_counters_stop(Bench_Counters* counters);
+
+#endif
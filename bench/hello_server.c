@@ -0,0 +1,74 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_builder.h"
+#include "http_server.h"
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+// Minimal server for http_load to measure against: answers every request with a fixed body.
+// Usage: hello_server [port] [threads] [auto|epoll|io_uring]
+static const char hello_content_type[] = "Content-Type: text/plain\r\n";
+static const char hello_body[] = "Hello, world!";
+
+static void hello_handler(Http_Connection* connection, const Http_Request* request, void* user_data)
+{
+	(void)request;
+	(void)user_data;
+	Http_Builder builder;
+	http_builder_init(&builder, 200);
+	http_builder_date(&builder);
+	http_builder_raw(&builder, hello_content_type, sizeof(hello_content_type) - 1);
+	http_builder_body(&builder, hello_body, sizeof(hello_body) - 1);
+	http_connection_writev(connection, builder.iov, builder.count);
+}
+
+int main(int argc, char** argv)
+{
+	const char* backend = argc > 3 ? argv[3] : "auto";
+	Http_Server_Config config = {
+		.port = argc > 1 ? atoi(argv[1]) : 8080,
+		.threads = argc > 2 ? atoi(argv[2]) : 0,
+		.handler = hello_handler,
+		.backend = !strcmp(backend, "epoll") ? HTTP_SERVER_EPOLL : !strcmp(backend, "io_uring") ? HTTP_SERVER_IO_URING : HTTP_SERVER_AUTO
+	};
+
+	// Blocked before the loops start so that only sigwait sees them
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	Http_Server* server = http_server_create(&config);
+	if (server == NULL || http_server_start(server) < 0) {
+		perror("http_server_start");
+		http_server_destroy(server);
+		return 1;
+	}
+
+	printf("Listening on port %d with %s\n", config.port, http_server_backend(server) == HTTP_SERVER_IO_URING ? "io_uring" : "epoll");
+	int signal;
+	sigwait(&signals, &signal);
+
+	http_server_stop(server);
+#ifdef HTTP_STATS
+	Http_Stats stats;
+	http_server_stats(server, &stats);
+	uint64_t errors = 0;
+	for (int i = 0; i < 256; ++i)
+		errors += stats.errors[i];
+	double messages = stats.messages ? stats.messages : 1;
+	printf("%llu requests in %llu parser runs, %llu errors\n", (unsigned long long)stats.messages, (unsigned long long)stats.runs, (unsigned long long)errors);
+	printf("cycles/req: index %.0f, start line %.0f, headers %.0f, body %.0f\n",
+		stats.cycles[HTTP_PHASE_INDEX] / messages, stats.cycles[HTTP_PHASE_START_LINE] / messages,
+		stats.cycles[HTTP_PHASE_HEADERS] / messages, stats.cycles[HTTP_PHASE_BODY] / messages);
+	printf("%.1f headers/req (max %llu), %.0f arena B/req\n", stats.headers / messages, (unsigned long long)stats.max_headers, stats.arena_bytes / messages);
+#endif
+	http_server_destroy(server);
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_parser.h"
+#include "http_stats.h"
+#include "corpus.h"
+#include "counters.h"
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+// Parses in batches until the time budget is spent, resetting the arena in between
+#define BENCH_BATCH 256
+
+// Bench mode beside the parser flags: events through Http_Callbacks, nothing stored
+#define BENCH_CALLBACKS 0x80
+
+static const char* level_names[] = { "scalar", "sse2", "avx2" };
+
+static const char* bench_mode_name(uint8_t flags)
+{
+	if (flags & BENCH_CALLBACKS)
+		return "callbacks";
+	return flags ? "zero-copy" : "copy";
+}
+
+// What a consumer that looks at every header would at least do
+static uint8_t bench_on_header(void* user_data, const char* name, size_t name_len, const char* value, size_t value_len)
+{
+	(void)name;
+	(void)name_len;
+	(void)value;
+	(void)value_len;
+	++*(size_t*)user_data;
+	return HTTP_SUCCESS;
+}
+
+static const Http_Callbacks bench_callbacks = { .on_header = bench_on_header };
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint8_t bench_parse(const Bench_Case* bench, uint8_t flags, Http_Request* req, Arena* arena)
+{
+	if (flags == 0)
+		return http_parse_request(bench->data, bench->len, req, arena);
+
+	size_t headers = 0;
+	Http_Parser parser;
+	http_parser_init(&parser, flags & ~BENCH_CALLBACKS);
+	if (flags & BENCH_CALLBACKS) {
+		parser.callbacks = &bench_callbacks;
+		parser.user_data = &headers;
+	}
+	return http_parser_execute(&parser, bench->data, bench->len, req, arena);
+}
+
+// Second line per run with whatever of the parser stats and hardware counters is there
+static void bench_print_details(size_t requests, const Bench_Counters* counters)
+{
+	char line[256];
+	int len = 0;
+#ifdef HTTP_STATS
+	static const char* phase_names[HTTP_PHASE_COUNT] = { "index", "start", "headers", "body" };
+	const Http_Stats* stats = http_stats_thread();
+	len += snprintf(line + len, sizeof(line) - len, ", cycles/req");
+	for (int i = 0; i < HTTP_PHASE_COUNT; ++i)
+		len += snprintf(line + len, sizeof(line) - len, " %s %.0f", phase_names[i], (double)stats->cycles[i] / requests);
+	len += snprintf(line + len, sizeof(line) - len, ", %.1f headers/req", (double)stats->headers / requests);
+#endif
+	static const char* counter_names[BENCH_COUNTER_COUNT] = { "instructions", "branch misses", "cache misses" };
+	for (int i = 0; i < BENCH_COUNTER_COUNT; ++i) {
+		if (bench_counters_available(counters, i))
+			len += snprintf(line + len, sizeof(line) - len, ", %.1f %s/req", (double)counters->values[i] / requests, counter_names[i]);
+	}
+	// Every part starts with a separator
+	if (len > 0)
+		printf("%-12s %s\n", "", line + 2);
+}
+
+static void bench_run(const Bench_Case* bench, uint8_t level, uint8_t flags, double seconds, Bench_Counters* counters)
+{
+	Arena arena = arena_create(0x4000);
+	Http_Request req;
+
+	// One untimed parse to check the request and measure its arena footprint
+	memset(&req, 0, sizeof(req));
+	uint8_t status = bench_parse(bench, flags, &req, &arena);
+	size_t arena_bytes = arena_used(&arena);
+	if (status) {
+		char error[50];
+		http_get_error_str(status, error, sizeof(error));
+		printf("%-12s %-7s %-10s HTTP error %d: %s\n", bench->name, level_names[level], bench_mode_name(flags), status, error);
+		arena_destroy(&arena);
+		return;
+	}
+
+	size_t requests = 0;
+	http_stats_reset(http_stats_thread());
+	bench_counters_start(counters);
+	double start = bench_now();
+	double elapsed = 0;
+	while (elapsed < seconds) {
+		for (int i = 0; i < BENCH_BATCH; ++i) {
+			arena_reset(&arena);
+			memset(&req, 0, sizeof(req));
+			bench_parse(bench, flags, &req, &arena);
+		}
+		requests += BENCH_BATCH;
+		elapsed = bench_now() - start;
+	}
+	bench_counters_stop(counters);
+
+	printf("%-12s %-7s %-10s %12.0f req/s %9.1f MB/s %9.1f ns/req %8zu arena B/req\n",
+		bench->name, level_names[level], bench_mode_name(flags),
+		requests / elapsed, requests * bench->len / elapsed / 1e6, elapsed * 1e9 / requests, arena_bytes);
+	bench_print_details(requests, counters);
+	arena_destroy(&arena);
+}
+
+int main(int argc, char** argv)
+{
+	double seconds = argc > 1 ? atof(argv[1]) : 0.25;
+	if (seconds <= 0)
+		seconds = 0.25;
+
+	size_t count;
+	const Bench_Case* corpus = bench_corpus(&count);
+	Bench_Counters counters;
+	bench_counters_open(&counters);
+
+	for (size_t i = 0; i < count; ++i) {
+		for (uint8_t level = HTTP_SCAN_SCALAR; level <= HTTP_SCAN_AVX2; ++level) {
+			// Levels the CPU lacks fall back to one that was already measured
+			if (http_scan_set_level(level) != level)
+				continue;
+			bench_run(&corpus[i], level, 0, seconds, &counters);
+			bench_run(&corpus[i], level, HTTP_PARSE_ZERO_COPY, seconds, &counters);
+			bench_run(&corpus[i], level, BENCH_CALLBACKS, seconds, &counters);
+		}
+	}
+
+	bench_counters_close(&counters);
+	return 0;
+}
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "http_parser.h"
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+// Loopback load generator: keeps a number of keep-alive connections busy with one
+// request in flight each and reports throughput and latency percentiles.
+// Usage: http_load [port] [connections] [threads] [seconds] [path]
+
+#define LOAD_BUFFER_SIZE 0x4000
+
+typedef struct {
+	int fd;
+	char buffer[LOAD_BUFFER_SIZE];
+	size_t len;
+	uint64_t sent_at;
+	Http_Parser parser;
+	Http_Response response;
+	// Per connection, a response that completes must not free one still parsing elsewhere
+	Arena arena;
+} Load_Connection;
+
+typedef struct {
+	pthread_t thread;
+	int connections;
+	uint64_t* latencies;
+	size_t count;
+	size_t capacity;
+	size_t errors;
+} Load_Worker;
+
+static uint16_t port = 8080;
+static double seconds = 5;
+static char request[512];
+static size_t request_len;
+
+static uint64_t load_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int load_connect(void)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+static uint8_t load_send(Load_Connection* conn)
+{
+	conn->sent_at = load_now();
+	return send(conn->fd, request, request_len, MSG_NOSIGNAL) == (ssize_t)request_len;
+}
+
+static void load_record(Load_Worker* worker, uint64_t latency)
+{
+	if (worker->count == worker->capacity) {
+		size_t capacity = worker->capacity ? worker->capacity * 2 : 0x10000;
+		uint64_t* latencies = realloc(worker->latencies, capacity * sizeof(uint64_t));
+		if (latencies == NULL)
+			return;
+		worker->latencies = latencies;
+		worker->capacity = capacity;
+	}
+	worker->latencies[worker->count++] = latency;
+}
+
+static void* load_run(void* arg)
+{
+	Load_Worker* worker = arg;
+	Load_Connection* conns = calloc(worker->connections, sizeof(Load_Connection));
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+	for (int i = 0; i < worker->connections; ++i) {
+		conns[i].fd = load_connect();
+		if (conns[i].fd < 0) {
+			worker->errors++;
+			continue;
+		}
+		http_parser_init(&conns[i].parser, HTTP_PARSE_ZERO_COPY);
+		conns[i].arena = arena_create(0x1000);
+		struct epoll_event event = { .events = EPOLLIN, .data.ptr = &conns[i] };
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conns[i].fd, &event);
+		if (!load_send(&conns[i]))
+			worker->errors++;
+	}
+
+	uint64_t end = load_now() + (uint64_t)(seconds * 1e9);
+	struct epoll_event events[64];
+	while (load_now() < end) {
+		int count = epoll_wait(epoll_fd, events, 64, 100);
+		for (int i = 0; i < count; ++i) {
+			Load_Connection* conn = events[i].data.ptr;
+			ssize_t received = recv(conn->fd, conn->buffer + conn->len, LOAD_BUFFER_SIZE - conn->len, 0);
+			if (received <= 0) {
+				worker->errors++;
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+				continue;
+			}
+			conn->len += received;
+
+			uint8_t status = http_parser_execute_response(&conn->parser, conn->buffer, conn->len, &conn->response, &conn->arena);
+			if (status == HTTP_END_OF_CONTENT)
+				continue;
+			if (status || conn->response.status_code != 200)
+				worker->errors++;
+			else
+				load_record(worker, load_now() - conn->sent_at);
+
+			// One request in flight, so nothing follows the response
+			conn->len = 0;
+			memset(&conn->response, 0, sizeof(Http_Response));
+			http_parser_init(&conn->parser, HTTP_PARSE_ZERO_COPY);
+			arena_reset(&conn->arena);
+			if (!load_send(conn))
+				worker->errors++;
+		}
+	}
+
+	for (int i = 0; i < worker->connections; ++i) {
+		if (conns[i].fd >= 0) {
+			close(conns[i].fd);
+			arena_destroy(&conns[i].arena);
+		}
+	}
+	close(epoll_fd);
+	free(conns);
+	return NULL;
+}
+
+static int load_compare(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv)
+{
+	port = argc > 1 ? atoi(argv[1]) : 8080;
+	int connections = argc > 2 ? atoi(argv[2]) : 64;
+	int threads = argc > 3 ? atoi(argv[3]) : 2;
+	seconds = argc > 4 ? atof(argv[4]) : 5;
+	const char* path = argc > 5 ? argv[5] : "/";
+	if (connections < 1 || threads < 1 || seconds <= 0) {
+		fprintf(stderr, "Usage: %s [port] [connections] [threads] [seconds] [path]\n", argv[0]);
+		return 1;
+	}
+	if (threads > connections)
+		threads = connections;
+
+	request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nUser-Agent: http_load\r\nAccept: */*\r\n\r\n", path, port);
+
+	Load_Worker* workers = calloc(threads, sizeof(Load_Worker));
+	for (int i = 0; i < threads; ++i) {
+		workers[i].connections = connections / threads + (i < connections % threads);
+		pthread_create(&workers[i].thread, NULL, load_run, &workers[i]);
+	}
+
+	size_t total = 0;
+	size_t errors = 0;
+	for (int i = 0; i < threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].count;
+		errors += workers[i].errors;
+	}
+
+	uint64_t* latencies = malloc((total ? total : 1) * sizeof(uint64_t));
+	size_t offset = 0;
+	for (int i = 0; i < threads; ++i) {
+		memcpy(latencies + offset, workers[i].latencies, workers[i].count * sizeof(uint64_t));
+		offset += workers[i].count;
+		free(workers[i].latencies);
+	}
+	qsort(latencies, total, sizeof(uint64_t), load_compare);
+
+	printf("%zu requests in %.2f s, %zu errors, %d connections on %d threads\n", total, seconds, errors, connections, threads);
+	printf("%.0f req/s\n", total / seconds);
+	if (total) {
+		const double percentiles[] = { 50, 90, 99, 99.9 };
+		for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i)
+			printf("p%-5g %8.1f us\n", percentiles[i], latencies[(size_t)(total * percentiles[i] / 100)] / 1e3);
+		printf("max    %8.1f us\n", latencies[total - 1] / 1e3);
+	}
+
+	free(latencies);
+	free(workers);
+	return errors != 0;
+}
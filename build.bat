@@ -1,5 +1,10 @@
 rm main.exe
 rm bin/*.o
+gcc -g -c -o bin\http_scan.o http_scan.c -I.
+gcc -g -c -o bin\http_headers.o http_headers.c -I.
 gcc -g -c -o bin\http_parser.o http_parser.c -I.
+gcc -g -c -o bin\http_query.o http_query.c -I.
+gcc -g -c -o bin\http_stats.o http_stats.c -I.
+gcc -g -c -o bin\http_builder.o http_builder.c -I.
 gcc -g -c -o bin\main.o main.c -I.
-gcc -g -o main.exe bin\http_parser.o bin\main.o
+gcc -g -o main.exe bin\http_scan.o bin\http_headers.o bin\http_parser.o bin\http_query.o bin\http_stats.o bin\http_builder.o bin\main.o
@@ -2,105 +2,269 @@
 #define CUP_HASHTABLE_H
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-#define BUCKETS 11
+#include "arena.h"
 
-typedef struct hashtable_node_t {
-	struct hashtable_node_t* next;
-	char* key;
+// Open addressing with linear probing. Each slot stores its key's hash, so a
+// probe only touches keys whose hash matches, and 0 marks an empty slot.
+// Keys are referenced, not copied, unless HASHTABLE_COPY_KEYS is set. Values
+// are copied by hashtable_set as before, while hashtable_put stores the caller's
+// pointer as it is.
+//
+// The http_parser library compiles the implementation (CUP_HASHTABLE_IMPLEMENTATION
+// in http_parser.c); programs linking it include this header without defining it.
+
+#define HASHTABLE_MIN_CAPACITY 8
+
+// Table flags
+#define HASHTABLE_CASE_INSENSITIVE	0x01	// ASCII case folding, e.g. for header names
+#define HASHTABLE_COPY_KEYS			0x02	// Copy keys (into the arena if the table has one)
+
+typedef struct {
+	uint64_t hash;
+	const char* key;
+	size_t key_len;
 	void* data;
-	uint64_t data_size;
-} hashtable_node_t;
+	uint64_t data_size;		// Bytes copied by hashtable_set, 0 for a pointer from hashtable_put
+} hashtable_entry_t;
 
 typedef struct {
-	hashtable_node_t* buckets[BUCKETS];
-	uint64_t bucket_count;
+	hashtable_entry_t* entries;
+	uint64_t capacity;
+	uint64_t count;
+	uint8_t flags;
+	Arena* arena;
 } hashtable_t;
 
 hashtable_t* hashtable_alloc();
 void hashtable_free(hashtable_t* ht);
-uint64_t hashtable_calc_hash(const char* key);
+// Sized for expected keys without growing. With an arena, every allocation
+// comes from it (a grown table leaves its old slots there) and hashtable_destroy is not needed.
+// Returns 0 if out of memory.
+uint8_t hashtable_init(hashtable_t* ht, uint64_t expected, uint8_t flags, Arena* arena);
+void hashtable_destroy(hashtable_t* ht);
+uint64_t hashtable_calc_hash(const char* key, size_t len, uint8_t flags);
 void* hashtable_get(const hashtable_t* ht, const char* key);
-void  hashtable_set(hashtable_t* ht, const char* key, const void* data, uint64_t data_size);
+void* hashtable_get_n(const hashtable_t* ht, const char* key, size_t len);
+// Both replace the data of an existing key and return 0 if out of memory.
+// Stores a copy of data_size bytes of data, owned by the table (or its arena).
+uint8_t hashtable_set(hashtable_t* ht, const char* key, const void* data, uint64_t data_size);
+// Stores data itself, which has to outlive the table
+uint8_t hashtable_put(hashtable_t* ht, const char* key, void* data);
+uint8_t hashtable_put_n(hashtable_t* ht, const char* key, size_t len, void* data);
 
 #endif
 
 
 #ifdef CUP_HASHTABLE_IMPLEMENTATION
 
-uint64_t hashtable_calc_hash(const char* key)
+static inline char hashtable_fold(char c, uint8_t flags)
+{
+	if ((flags & HASHTABLE_CASE_INSENSITIVE) && 'A' <= c && c <= 'Z')
+		return c | 0x20;
+	return c;
+}
+
+// FNV-1a, never 0 so that it can mark empty slots
+uint64_t hashtable_calc_hash(const char* key, size_t len, uint8_t flags)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)hashtable_fold(key[i], flags);
+		hash *= 0x100000001b3;
+	}
+	return hash ? hash : 1;
+}
+
+static uint8_t hashtable_key_equals(const hashtable_entry_t* entry, const char* key, size_t len, uint8_t flags)
+{
+	if (entry->key_len != len)
+		return 0;
+	if (!(flags & HASHTABLE_CASE_INSENSITIVE))
+		return !memcmp(entry->key, key, len);
+
+	for (size_t i = 0; i < len; ++i) {
+		if (hashtable_fold(entry->key[i], flags) != hashtable_fold(key[i], flags))
+			return 0;
+	}
+	return 1;
+}
+
+static void* hashtable_mem_alloc(hashtable_t* ht, size_t bytes)
+{
+	if (ht->arena != NULL)
+		return arena_alloc(ht->arena, bytes);
+	return malloc(bytes);
+}
+
+static hashtable_entry_t* hashtable_find_slot(hashtable_entry_t* entries, uint64_t capacity, uint64_t hash, const char* key, size_t len, uint8_t flags)
+{
+	uint64_t mask = capacity - 1;
+	for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+		hashtable_entry_t* entry = &entries[i];
+		if (entry->hash == 0 || (entry->hash == hash && hashtable_key_equals(entry, key, len, flags)))
+			return entry;
+	}
+}
+
+static uint8_t hashtable_resize(hashtable_t* ht, uint64_t capacity)
+{
+	hashtable_entry_t* entries = hashtable_mem_alloc(ht, capacity * sizeof(hashtable_entry_t));
+	if (entries == NULL)
+		return 0;
+	memset(entries, 0, capacity * sizeof(hashtable_entry_t));
+
+	for (uint64_t i = 0; i < ht->capacity; ++i) {
+		hashtable_entry_t* entry = &ht->entries[i];
+		if (entry->hash == 0)
+			continue;
+
+		uint64_t mask = capacity - 1;
+		uint64_t slot = entry->hash & mask;
+		while (entries[slot].hash)
+			slot = (slot + 1) & mask;
+		entries[slot] = *entry;
+	}
+
+	if (ht->arena == NULL)
+		free(ht->entries);
+	ht->entries = entries;
+	ht->capacity = capacity;
+	return 1;
+}
+
+uint8_t hashtable_init(hashtable_t* ht, uint64_t expected, uint8_t flags, Arena* arena)
 {
-	uint64_t hash = 0;
-	for(char* it = (char*)key; *it != 0; ++it)
-		hash = *it + 31 * hash;
-	return hash % BUCKETS;		
+	memset(ht, 0, sizeof(hashtable_t));
+	ht->flags = flags;
+	ht->arena = arena;
+
+	// Keeps the load factor under 3/4
+	uint64_t capacity = HASHTABLE_MIN_CAPACITY;
+	while (capacity - capacity / 4 <= expected)
+		capacity <<= 1;
+
+	return hashtable_resize(ht, capacity);
 }
 
 hashtable_t* hashtable_alloc()
 {
 	hashtable_t* ht = malloc(sizeof(hashtable_t));
-	ht->bucket_count = BUCKETS;
-	memset(ht->buckets, 0, sizeof(ht->buckets));
+	if (ht == NULL)
+		return NULL;
+
+	if (!hashtable_init(ht, 0, 0, NULL)) {
+		free(ht);
+		return NULL;
+	}
 	return ht;
 }
 
+void* hashtable_get_n(const hashtable_t* ht, const char* key, size_t len)
+{
+	if (ht->entries == NULL)
+		return NULL;
+
+	uint64_t hash = hashtable_calc_hash(key, len, ht->flags);
+	hashtable_entry_t* entry = hashtable_find_slot(ht->entries, ht->capacity, hash, key, len, ht->flags);
+	return entry->hash ? entry->data : NULL;
+}
+
 void* hashtable_get(const hashtable_t* ht, const char* key)
 {
-	uint64_t index = hashtable_calc_hash(key);
-	hashtable_node_t* node = ht->buckets[index];
-	while (node) {
-		if (!strcmp(key, node->key))
-			return node->data;
-		node = node->next;
-	}
+	return hashtable_get_n(ht, key, strlen(key));
+}
 
-	return NULL;
+static void hashtable_release_data(hashtable_t* ht, hashtable_entry_t* entry)
+{
+	if (ht->arena == NULL && entry->data_size)
+		free(entry->data);
 }
 
-// When updating key values, you are responsible for freeing the previous object
-void hashtable_set(hashtable_t* ht, const char* key, const void* data, uint64_t data_size)
+static uint8_t hashtable_store(hashtable_t* ht, const char* key, size_t len, void* data, uint64_t data_size)
 {
-	uint64_t index = hashtable_calc_hash(key);
-	hashtable_node_t* last = NULL;
-	hashtable_node_t* node = ht->buckets[index];
+	if (ht->entries == NULL)
+		return 0;
 
-	// Search for key
-	while (node) {
-		if (!strcmp(key, node->key)) {
-			// Key found, replace data
-			goto CUP_HASHTABLE_UPDATE;
-		}
-		last = node;
-		node = node->next;
+	uint64_t hash = hashtable_calc_hash(key, len, ht->flags);
+	hashtable_entry_t* entry = hashtable_find_slot(ht->entries, ht->capacity, hash, key, len, ht->flags);
+	if (entry->hash) {
+		hashtable_release_data(ht, entry);
+		entry->data = data;
+		entry->data_size = data_size;
+		return 1;
 	}
 
-	// Add if not exists
-	node = malloc(sizeof(hashtable_node_t));
-	node->next = NULL;
-	node->key = malloc(strlen(key));
-	strcpy(node->key, key);
+	if (ht->count + 1 > ht->capacity - ht->capacity / 4) {
+		if (!hashtable_resize(ht, ht->capacity * 2))
+			return 0;
+		entry = hashtable_find_slot(ht->entries, ht->capacity, hash, key, len, ht->flags);
+	}
 
-	if (last) last->next = node;
-	else ht->buckets[index] = node;
+	if (ht->flags & HASHTABLE_COPY_KEYS) {
+		char* copy = hashtable_mem_alloc(ht, len + 1);
+		if (copy == NULL)
+			return 0;
+		memcpy(copy, key, len);
+		copy[len] = '\0';
+		key = copy;
+	}
 
-CUP_HASHTABLE_UPDATE:
-	node->data_size = data_size;
-	node->data = malloc(data_size);
-	memcpy(node->data, data, data_size);
+	entry->hash = hash;
+	entry->key = key;
+	entry->key_len = len;
+	entry->data = data;
+	entry->data_size = data_size;
+	ht->count++;
+	return 1;
 }
 
-void hashtable_free(hashtable_t* ht)
+uint8_t hashtable_put_n(hashtable_t* ht, const char* key, size_t len, void* data)
 {
-	hashtable_node_t* previous;
-	hashtable_node_t* current;
-	for (uint64_t i = 0; i < ht->bucket_count; ++i) {
-		current = ht->buckets[i];
-		while (current) {
-			previous = current;
-			current = current->next;
-			free(previous);
+	return hashtable_store(ht, key, len, data, 0);
+}
+
+uint8_t hashtable_put(hashtable_t* ht, const char* key, void* data)
+{
+	return hashtable_store(ht, key, strlen(key), data, 0);
+}
+
+uint8_t hashtable_set(hashtable_t* ht, const char* key, const void* data, uint64_t data_size)
+{
+	// At least one byte, so that the copy is told apart from a stored pointer
+	void* copy = hashtable_mem_alloc(ht, data_size ? data_size : 1);
+	if (copy == NULL)
+		return 0;
+	memcpy(copy, data, data_size);
+
+	if (!hashtable_store(ht, key, strlen(key), copy, data_size ? data_size : 1)) {
+		if (ht->arena == NULL)
+			free(copy);
+		return 0;
+	}
+	return 1;
+}
+
+void hashtable_destroy(hashtable_t* ht)
+{
+	if (ht->arena == NULL) {
+		for (uint64_t i = 0; i < ht->capacity; ++i) {
+			if (ht->entries[i].hash == 0)
+				continue;
+			if (ht->flags & HASHTABLE_COPY_KEYS)
+				free((char*)ht->entries[i].key);
+			hashtable_release_data(ht, &ht->entries[i]);
 		}
+		free(ht->entries);
 	}
+	memset(ht, 0, sizeof(hashtable_t));
+}
+
+void hashtable_free(hashtable_t* ht)
+{
+	hashtable_destroy(ht);
 	free(ht);
 }
 #endif
@@ -0,0 +1,206 @@
+#include <string.h>
+#include <time.h>
+
+#include "http_builder.h"
+#include "http_scan.h"
+
+#define HTTP_STATIC(s) s, sizeof(s) - 1
+
+static const char http_crlf[] = "\r\n";
+static const char http_colon[] = ": ";
+
+typedef struct {
+	time_t second;
+	char line[HTTP_DATE_HEADER_LEN + 1];
+} Http_Date_Cache;
+
+static _Thread_local Http_Date_Cache http_date_cache = { .second = -1 };
+
+static const char http_day_names[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char http_month_names[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+static char* http_put_2digits(char* it, int value)
+{
+	*it++ = '0' + value / 10;
+	*it++ = '0' + value % 10;
+	return it;
+}
+
+// IMF-fixdate (RFC 9110, 5.6.7), written out by hand since strftime follows the locale
+static void http_format_date(char* line, time_t now)
+{
+	struct tm tm;
+#ifdef _WIN32
+	gmtime_s(&tm, &now);
+#else
+	gmtime_r(&now, &tm);
+#endif
+
+	char* it = line;
+	memcpy(it, "Date: ", 6);
+	it += 6;
+	memcpy(it, http_day_names[tm.tm_wday], 3);
+	it += 3;
+	*it++ = ',';
+	*it++ = ' ';
+	it = http_put_2digits(it, tm.tm_mday);
+	*it++ = ' ';
+	memcpy(it, http_month_names[tm.tm_mon], 3);
+	it += 3;
+	*it++ = ' ';
+	int year = tm.tm_year + 1900;
+	it = http_put_2digits(it, year / 100 % 100);
+	it = http_put_2digits(it, year % 100);
+	*it++ = ' ';
+	it = http_put_2digits(it, tm.tm_hour);
+	*it++ = ':';
+	it = http_put_2digits(it, tm.tm_min);
+	*it++ = ':';
+	it = http_put_2digits(it, tm.tm_sec);
+	memcpy(it, " GMT\r\n", 7);
+}
+
+const char* http_date_header(void)
+{
+	time_t now = time(NULL);
+	if (now != http_date_cache.second) {
+		http_format_date(http_date_cache.line, now);
+		http_date_cache.second = now;
+	}
+	return http_date_cache.line;
+}
+
+static const char* http_status_line(uint16_t status, size_t* len)
+{
+#define HTTP_STATUS(code, line) case code: *len = sizeof(line) - 1; return line;
+	switch (status) {
+		HTTP_STATUS(100, "HTTP/1.1 100 Continue\r\n")
+		HTTP_STATUS(101, "HTTP/1.1 101 Switching Protocols\r\n")
+		HTTP_STATUS(200, "HTTP/1.1 200 OK\r\n")
+		HTTP_STATUS(201, "HTTP/1.1 201 Created\r\n")
+		HTTP_STATUS(202, "HTTP/1.1 202 Accepted\r\n")
+		HTTP_STATUS(204, "HTTP/1.1 204 No Content\r\n")
+		HTTP_STATUS(206, "HTTP/1.1 206 Partial Content\r\n")
+		HTTP_STATUS(301, "HTTP/1.1 301 Moved Permanently\r\n")
+		HTTP_STATUS(302, "HTTP/1.1 302 Found\r\n")
+		HTTP_STATUS(303, "HTTP/1.1 303 See Other\r\n")
+		HTTP_STATUS(304, "HTTP/1.1 304 Not Modified\r\n")
+		HTTP_STATUS(307, "HTTP/1.1 307 Temporary Redirect\r\n")
+		HTTP_STATUS(308, "HTTP/1.1 308 Permanent Redirect\r\n")
+		HTTP_STATUS(400, "HTTP/1.1 400 Bad Request\r\n")
+		HTTP_STATUS(401, "HTTP/1.1 401 Unauthorized\r\n")
+		HTTP_STATUS(403, "HTTP/1.1 403 Forbidden\r\n")
+		HTTP_STATUS(404, "HTTP/1.1 404 Not Found\r\n")
+		HTTP_STATUS(405, "HTTP/1.1 405 Method Not Allowed\r\n")
+		HTTP_STATUS(408, "HTTP/1.1 408 Request Timeout\r\n")
+		HTTP_STATUS(409, "HTTP/1.1 409 Conflict\r\n")
+		HTTP_STATUS(411, "HTTP/1.1 411 Length Required\r\n")
+		HTTP_STATUS(413, "HTTP/1.1 413 Content Too Large\r\n")
+		HTTP_STATUS(414, "HTTP/1.1 414 URI Too Long\r\n")
+		HTTP_STATUS(415, "HTTP/1.1 415 Unsupported Media Type\r\n")
+		HTTP_STATUS(416, "HTTP/1.1 416 Range Not Satisfiable\r\n")
+		HTTP_STATUS(417, "HTTP/1.1 417 Expectation Failed\r\n")
+		HTTP_STATUS(426, "HTTP/1.1 426 Upgrade Required\r\n")
+		HTTP_STATUS(429, "HTTP/1.1 429 Too Many Requests\r\n")
+		HTTP_STATUS(431, "HTTP/1.1 431 Request Header Fields Too Large\r\n")
+		HTTP_STATUS(500, "HTTP/1.1 500 Internal Server Error\r\n")
+		HTTP_STATUS(501, "HTTP/1.1 501 Not Implemented\r\n")
+		HTTP_STATUS(502, "HTTP/1.1 502 Bad Gateway\r\n")
+		HTTP_STATUS(503, "HTTP/1.1 503 Service Unavailable\r\n")
+		HTTP_STATUS(504, "HTTP/1.1 504 Gateway Timeout\r\n")
+		HTTP_STATUS(505, "HTTP/1.1 505 HTTP Version Not Supported\r\n")
+		default: return NULL;
+	}
+#undef HTTP_STATUS
+}
+
+static uint8_t http_builder_push(Http_Builder* builder, const void* data, size_t len)
+{
+	if (builder->error)
+		return builder->error;
+	if (len == 0)
+		return HTTP_SUCCESS;
+	if (builder->count == HTTP_BUILDER_MAX_IOV)
+		return builder->error = HTTP_OOM;
+
+	builder->iov[builder->count].iov_base = (void*)data;
+	builder->iov[builder->count].iov_len = len;
+	builder->count++;
+	builder->len += len;
+	return HTTP_SUCCESS;
+}
+
+void http_builder_init(Http_Builder* builder, uint16_t status)
+{
+	builder->count = 0;
+	builder->len = 0;
+	builder->error = HTTP_SUCCESS;
+
+	size_t len;
+	const char* line = http_status_line(status, &len);
+	if (line == NULL) {
+		// "HTTP/1.1 599 \r\n", the reason phrase may be empty
+		status %= 1000;
+		memcpy(builder->status_line, "HTTP/1.1 ", 9);
+		builder->status_line[9] = '0' + status / 100;
+		builder->status_line[10] = '0' + status / 10 % 10;
+		builder->status_line[11] = '0' + status % 10;
+		memcpy(builder->status_line + 12, " \r\n", 3);
+		line = builder->status_line;
+		len = 15;
+	}
+	http_builder_push(builder, line, len);
+}
+
+uint8_t http_builder_header(Http_Builder* builder, const char* name, size_t name_len, const char* value, size_t value_len)
+{
+	// A CR, LF or NUL would let the caller's data end the header early and start one of its own
+	if (!builder->error) {
+		if (name_len == 0 || http_scan_tchar(name, name + name_len) != name + name_len)
+			builder->error = HTTP_HEADER_EXPECTED;
+		else if (http_scan_vchar(value, value + value_len) != value + value_len)
+			builder->error = HTTP_INVALID_HEADER_BYTE;
+	}
+
+	// All four or none, so a full builder never holds half a header
+	if (builder->count > HTTP_BUILDER_MAX_IOV - 4 && !builder->error)
+		builder->error = HTTP_OOM;
+
+	http_builder_push(builder, name, name_len);
+	http_builder_push(builder, HTTP_STATIC(http_colon));
+	http_builder_push(builder, value, value_len);
+	return http_builder_push(builder, HTTP_STATIC(http_crlf));
+}
+
+uint8_t http_builder_raw(Http_Builder* builder, const void* data, size_t len)
+{
+	return http_builder_push(builder, data, len);
+}
+
+uint8_t http_builder_date(Http_Builder* builder)
+{
+	return http_builder_push(builder, http_date_header(), HTTP_DATE_HEADER_LEN);
+}
+
+uint8_t http_builder_body(Http_Builder* builder, const void* body, size_t len)
+{
+	// Digits are written backwards from the end of the line
+	char* end = builder->content_length + sizeof(builder->content_length);
+	char* it = end - 4;
+	memcpy(it, "\r\n\r\n", 4);
+	size_t value = len;
+	do {
+		*--it = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	it -= sizeof("Content-Length: ") - 1;
+	memcpy(it, "Content-Length: ", sizeof("Content-Length: ") - 1);
+
+	http_builder_push(builder, it, end - it);
+	return http_builder_push(builder, body, len);
+}
+
+uint8_t http_builder_end(Http_Builder* builder)
+{
+	return http_builder_push(builder, HTTP_STATIC(http_crlf));
+}
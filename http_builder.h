@@ -0,0 +1,67 @@
+#ifndef HTTP_BUILDER_H
+#define HTTP_BUILDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+// Same layout as POSIX; map it to WSABUF for WSASend or copy it out
+struct iovec {
+	void* iov_base;
+	size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
+#include "http_parser.h"
+
+// Builds a response as a list of pieces ready for writev or sendmsg, without
+// copying or formatting what is already there: the status line and separators
+// are static strings, names, values and the body stay wherever the caller keeps
+// them (static data, the request's arena, its own buffers), and only the status
+// line of an uncommon code and Content-Length are formatted, into the builder.
+// Everything referenced has to stay alive until the response is written.
+//
+//	Http_Builder builder;
+//	http_builder_init(&builder, 200);
+//	http_builder_date(&builder);
+//	http_builder_header(&builder, "Content-Type", 12, "text/plain", 10);
+//	http_builder_body(&builder, body, body_len);
+//	writev(fd, builder.iov, builder.count);
+
+#ifndef HTTP_BUILDER_MAX_IOV
+#define HTTP_BUILDER_MAX_IOV 64
+#endif
+
+typedef struct {
+	struct iovec iov[HTTP_BUILDER_MAX_IOV];
+	int count;
+	size_t len;					// Bytes in all of iov
+	uint8_t error;				// First failure, every later call is ignored
+	char status_line[32];
+	char content_length[40];
+} Http_Builder;
+
+// Length of the Date line http_date_header returns, CRLF included
+#define HTTP_DATE_HEADER_LEN 37
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n" for the current second. Each thread
+// keeps its own copy and only formats it again once the second has changed,
+// so the line stays valid until the thread asks for it in a later second.
+const char* http_date_header(void);
+
+// Starts the response with the status line; codes without a known reason get an empty one
+void http_builder_init(Http_Builder* builder, uint16_t status);
+// Adds "name: value\r\n" as four pieces, HTTP_OOM once iov is full. The name has to be a
+// token (HTTP_HEADER_EXPECTED) and the value visible characters, spaces and tabs (HTTP_INVALID_HEADER_BYTE).
+uint8_t http_builder_header(Http_Builder* builder, const char* name, size_t name_len, const char* value, size_t value_len);
+// Adds bytes as they are, e.g. a static "Connection: close\r\n"
+uint8_t http_builder_raw(Http_Builder* builder, const void* data, size_t len);
+uint8_t http_builder_date(Http_Builder* builder);
+// Adds Content-Length, ends the head and adds the body (none if len is 0)
+uint8_t http_builder_body(Http_Builder* builder, const void* body, size_t len);
+// Ends the head without a body or Content-Length, for 204 and 304 or framing of the caller's own
+uint8_t http_builder_end(Http_Builder* builder);
+
+#endif
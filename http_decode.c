@@ -0,0 +1,169 @@
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+
+#include <zlib.h>
+
+#include "http_decode.h"
+
+// zlib allocates its state and history window through the arena, the whole
+// lot goes away with the message, so nothing leaks when a body is abandoned
+static voidpf http_decoder_alloc(voidpf opaque, uInt items, uInt size)
+{
+	return arena_alloc(opaque, (size_t)items * size);
+}
+
+static void http_decoder_free(voidpf opaque, voidpf address)
+{
+	(void)opaque;
+	(void)address;
+}
+
+static uint8_t http_decoder_is_ows(const char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+// Codings are case-insensitive tokens (RFC 9110, 8.4.1), the value is matched without its OWS
+static uint8_t http_decoder_is(const char* value, size_t value_len, const char* coding, size_t len)
+{
+	return value_len == len && strncasecmp(value, coding, len) == 0;
+}
+
+void http_decoder_init(Http_Decoder* decoder, size_t window_size, size_t max_output)
+{
+	memset(decoder, 0, sizeof(Http_Decoder));
+	decoder->window_size = window_size ? window_size : HTTP_DECODER_WINDOW;
+	decoder->max_output = max_output;
+}
+
+uint8_t http_decoder_start(Http_Decoder* decoder, const Http_Header* content_encoding, size_t max_body)
+{
+	decoder->coding = HTTP_CODING_IDENTITY;
+	decoder->done = 0;
+	decoder->total = 0;
+	decoder->limit = decoder->max_output ? decoder->max_output : max_body;
+	decoder->window = NULL;
+	decoder->stream = NULL;
+
+	if (content_encoding->name == NULL)
+		return HTTP_SUCCESS;
+
+	const char* value = content_encoding->value;
+	size_t len = content_encoding->value_len;
+	while (len && http_decoder_is_ows(*value)) {
+		value++;
+		len--;
+	}
+	while (len && http_decoder_is_ows(value[len - 1]))
+		len--;
+
+	if (http_decoder_is(value, len, "identity", 8))
+		return HTTP_SUCCESS;
+	if (http_decoder_is(value, len, "gzip", 4) || http_decoder_is(value, len, "x-gzip", 6))
+		decoder->coding = HTTP_CODING_GZIP;
+	else if (http_decoder_is(value, len, "deflate", 7))
+		decoder->coding = HTTP_CODING_DEFLATE;
+	else
+		return HTTP_UNSUPPORTED_ENCODING;
+
+	return HTTP_SUCCESS;
+}
+
+static uint8_t http_decoder_setup(Http_Decoder* decoder, Arena* arena)
+{
+	z_stream* stream = arena_alloc(arena, sizeof(z_stream));
+	decoder->window = arena_alloc(arena, decoder->window_size);
+	if (stream == NULL || decoder->window == NULL)
+		return HTTP_OOM;
+
+	memset(stream, 0, sizeof(z_stream));
+	stream->zalloc = http_decoder_alloc;
+	stream->zfree = http_decoder_free;
+	stream->opaque = arena;
+
+	// 16 + 15 accepts only the gzip wrapper, 15 only the zlib one
+	int window_bits = decoder->coding == HTTP_CODING_GZIP ? 16 + MAX_WBITS : MAX_WBITS;
+	int ret = inflateInit2(stream, window_bits);
+	if (ret != Z_OK)
+		return ret == Z_MEM_ERROR ? HTTP_OOM : HTTP_INVALID_ENCODING;
+
+	decoder->stream = stream;
+	return HTTP_SUCCESS;
+}
+
+uint8_t http_decoder_write(Http_Decoder* decoder, const char* data, size_t len, Http_Decoder_Sink sink, void* context, Arena* arena)
+{
+	if (decoder->coding == HTTP_CODING_IDENTITY)
+		return sink(context, data, len);
+	if (len == 0)
+		return HTTP_SUCCESS;
+
+	if (decoder->stream == NULL) {
+		uint8_t status = http_decoder_setup(decoder, arena);
+		if (status)
+			return status;
+	}
+
+	z_stream* stream = decoder->stream;
+	stream->next_in = (Bytef*)data;
+	while (len) {
+		// avail_in is 32 bits wide, feed huge pieces in parts
+		stream->avail_in = len > UINT_MAX ? UINT_MAX : (uInt)len;
+		len -= stream->avail_in;
+
+		do {
+			if (decoder->done) {
+				if (stream->avail_in == 0)
+					break;
+				// Bytes after the end are only allowed as another gzip member
+				if (decoder->coding != HTTP_CODING_GZIP || inflateReset(stream) != Z_OK)
+					return HTTP_INVALID_ENCODING;
+				decoder->done = 0;
+			}
+
+			stream->next_out = decoder->window;
+			stream->avail_out = decoder->window_size;
+			int ret = inflate(stream, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END)
+				decoder->done = 1;
+			else if (ret == Z_MEM_ERROR)
+				return HTTP_OOM;
+			else if (ret != Z_OK && ret != Z_BUF_ERROR)
+				return HTTP_INVALID_ENCODING;
+
+			size_t produced = decoder->window_size - stream->avail_out;
+			if (produced) {
+				if (decoder->limit && produced > decoder->limit - decoder->total)
+					return HTTP_BODY_TOO_LARGE;
+				decoder->total += produced;
+
+				uint8_t status = sink(context, (const char*)decoder->window, produced);
+				if (status)
+					return status;
+			}
+		// A full window may leave output still buffered inside zlib
+		} while (stream->avail_in || stream->avail_out == 0);
+	}
+
+	return HTTP_SUCCESS;
+}
+
+uint8_t http_decoder_end(Http_Decoder* decoder)
+{
+	if (decoder->coding == HTTP_CODING_IDENTITY)
+		return HTTP_SUCCESS;
+
+	// An empty body carries no stream at all, anything else has to reach its end
+	uint8_t status = HTTP_SUCCESS;
+	if (decoder->stream) {
+		if (!decoder->done)
+			status = HTTP_INVALID_ENCODING;
+		inflateEnd(decoder->stream);
+	}
+
+	decoder->coding = HTTP_CODING_IDENTITY;
+	decoder->stream = NULL;
+	decoder->window = NULL;
+	return status;
+}
@@ -0,0 +1,60 @@
+#ifndef HTTP_DECODE_H
+#define HTTP_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "http_parser.h"
+
+// Optional body stage that undoes a gzip or deflate Content-Encoding while the
+// body is parsed, built when zlib is available (HTTP_WITH_ZLIB). Attach one to
+// a parser and the body arrives decompressed: on_body is handed one output
+// window at a time, otherwise the decompressed body is kept in the arena and
+// the compressed bytes never are. body_len is then the decompressed length,
+// while the parser's max_body keeps bounding the bytes on the wire and, unless
+// max_output says otherwise, the decompressed ones too.
+//
+//	Http_Decoder decoder;
+//	http_decoder_init(&decoder, 0, 16 << 20);
+//	parser.decoder = &decoder;
+
+#ifndef HTTP_DECODER_WINDOW
+#define HTTP_DECODER_WINDOW 0x4000		// 16 KB
+#endif
+
+typedef enum {
+	HTTP_CODING_IDENTITY,
+	HTTP_CODING_GZIP,			// gzip and x-gzip, concatenated members included
+	HTTP_CODING_DEFLATE			// zlib format, as RFC 9110 defines deflate
+} Http_Coding;
+
+// Receives each decompressed window, a status other than HTTP_SUCCESS fails the body with it
+typedef uint8_t (*Http_Decoder_Sink)(void* context, const char* data, size_t len);
+
+struct Http_Decoder {
+	// Kept between messages
+	size_t window_size;			// Most bytes handed to the sink at once
+	size_t max_output;			// Decompressed size cap, 0 for the parser's max_body: HTTP_BODY_TOO_LARGE
+
+	uint8_t coding;
+	uint8_t done;				// End of the compressed stream seen
+	size_t total;				// Decompressed bytes so far
+	size_t limit;				// Cap in force for this message, 0 for none
+	unsigned char* window;
+	void* stream;				// zlib state in the arena, set up by the first write
+};
+
+// A window_size of 0 picks HTTP_DECODER_WINDOW
+void http_decoder_init(Http_Decoder* decoder, size_t window_size, size_t max_output);
+// Prepares for a message with this Content-Encoding (name NULL if absent): HTTP_UNSUPPORTED_ENCODING
+// for codings other than gzip, deflate and identity, which includes stacked codings. Without a
+// max_output the decompressed body is held to max_body, so a small body cannot inflate without bound.
+uint8_t http_decoder_start(Http_Decoder* decoder, const Http_Header* content_encoding, size_t max_body);
+// Decompresses the next piece of the body into the window, passing it to the sink each time it fills.
+// Its state is allocated in the arena, so the message must be done before the arena is reset.
+uint8_t http_decoder_write(Http_Decoder* decoder, const char* data, size_t len, Http_Decoder_Sink sink, void* context, Arena* arena);
+// Once the body is over: HTTP_INVALID_ENCODING if the compressed stream was cut short
+uint8_t http_decoder_end(Http_Decoder* decoder);
+
+#endif
@@ -0,0 +1,138 @@
+#include "http_headers.h"
+
+#define HTTP_HEADER_TABLE_SIZE 256
+
+// Generated by tools/gen_header_hash.py
+#define HTTP_HEADER_HASH_A 181
+#define HTTP_HEADER_HASH_B 219
+#define HTTP_HEADER_HASH_C 27
+#define HTTP_HEADER_HASH_D 103
+
+static const uint8_t http_header_slots[HTTP_HEADER_TABLE_SIZE] = 
+{
+	 0,  0,  0, 42,  0,  0,  0,  0,  0, 11,  0, 17, 20,  0,  0,  0,
+	 0,  0,  7,  0, 51,  0,  4, 19,  5,  0, 15,  0,  0,  0,  0,  0,
+	 0,  0,  0, 16, 55,  0, 53,  0, 71, 56,  0, 65,  0,  0,  0,  0,
+	 0,  0,  0,  0,  2,  0, 47,  0,  0, 61,  0,  0,  0,  0,  0, 27,
+	 0,  0,  0,  0,  6, 62, 30,  0,  0,  0,  0,  0, 60, 36,  0,  0,
+	 0,  0,  0,  0,  0,  0, 38,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	 0,  0, 24,  0,  0,  0,  0,  9,  0, 46,  0,  0,  0, 13,  0, 63,
+	 0,  0,  0, 72,  0,  0, 52,  0, 40,  0,  0, 64, 12,  0,  0,  0,
+	 0, 21, 31,  0,  0, 58,  0,  0, 44,  0,  0,  0, 43,  0,  0, 48,
+	 0,  0, 70,  0, 45,  0,  0,  0,  8, 33, 14,  0,  0,  0,  0,  0,
+	25,  3,  0,  0,  0, 26, 32,  0,  0,  0,  0, 22,  0,  0,  0,  0,
+	39,  0,  0,  0, 59,  1,  0,  0,  0,  0, 18,  0,  0,  0,  0,  0,
+	 0,  0, 29,  0, 34, 69,  0, 10,  0,  0,  0, 66, 54,  0,  0,  0,
+	 0,  0, 50,  0,  0,  0, 68,  0,  0,  0,  0,  0,  0,  0,  0, 41,
+	 0,  0,  0,  0,  0,  0,  0, 28,  0,  0,  0,  0, 35,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0, 23, 57,  0, 37, 67,  0, 49,  0,
+};
+
+static const char* http_header_names[HTTP_HEADER_ID_COUNT] = 
+{
+	NULL,
+	"accept",
+	"accept-charset",
+	"accept-encoding",
+	"accept-language",
+	"accept-ranges",
+	"access-control-allow-credentials",
+	"access-control-allow-headers",
+	"access-control-allow-methods",
+	"access-control-allow-origin",
+	"access-control-expose-headers",
+	"access-control-max-age",
+	"access-control-request-headers",
+	"access-control-request-method",
+	"age",
+	"allow",
+	"authorization",
+	"cache-control",
+	"connection",
+	"content-disposition",
+	"content-encoding",
+	"content-language",
+	"content-length",
+	"content-location",
+	"content-range",
+	"content-type",
+	"cookie",
+	"date",
+	"etag",
+	"expect",
+	"expires",
+	"forwarded",
+	"from",
+	"host",
+	"if-match",
+	"if-modified-since",
+	"if-none-match",
+	"if-range",
+	"if-unmodified-since",
+	"keep-alive",
+	"last-modified",
+	"link",
+	"location",
+	"max-forwards",
+	"origin",
+	"pragma",
+	"proxy-authenticate",
+	"proxy-authorization",
+	"range",
+	"referer",
+	"retry-after",
+	"sec-fetch-dest",
+	"sec-fetch-mode",
+	"sec-fetch-site",
+	"sec-fetch-user",
+	"server",
+	"set-cookie",
+	"strict-transport-security",
+	"te",
+	"trailer",
+	"transfer-encoding",
+	"upgrade",
+	"upgrade-insecure-requests",
+	"user-agent",
+	"vary",
+	"via",
+	"warning",
+	"www-authenticate",
+	"x-forwarded-for",
+	"x-forwarded-host",
+	"x-forwarded-proto",
+	"x-real-ip",
+	"x-request-id",
+};
+
+
+Http_Header_Id http_header_id(const char* name, size_t len)
+{
+	if (len < 2)
+		return HTTP_HEADER_UNKNOWN;
+
+	// Letters are folded to lowercase with 0x20; the final compare rejects anything else it aliases
+	const unsigned char* it = (const unsigned char*)name;
+	uint32_t hash = len * HTTP_HEADER_HASH_A
+		+ (it[0] | 0x20) * HTTP_HEADER_HASH_B
+		+ (it[len - 2] | 0x20) * HTTP_HEADER_HASH_C
+		+ (it[len - 1] | 0x20) * HTTP_HEADER_HASH_D;
+
+	uint8_t id = http_header_slots[hash & (HTTP_HEADER_TABLE_SIZE - 1)];
+	if (id == HTTP_HEADER_UNKNOWN)
+		return HTTP_HEADER_UNKNOWN;
+
+	const char* known = http_header_names[id];
+	for (size_t i = 0; i < len; ++i)
+		if ((it[i] | 0x20) != (unsigned char)known[i])
+			return HTTP_HEADER_UNKNOWN;
+
+	return known[len] == '\0' ? id : HTTP_HEADER_UNKNOWN;
+}
+
+const char* http_header_name(Http_Header_Id id)
+{
+	if (id >= HTTP_HEADER_ID_COUNT)
+		return NULL;
+	return http_header_names[id];
+}
@@ -1,11 +1,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "http_parser.h"
-#include "dynamic_array.h"
+#include "http_scan.h"
 #include "arena.h"
 
+#define CUP_HASHTABLE_IMPLEMENTATION
+#include "hashtable.h"
+
+#ifdef HTTP_WITH_ZLIB
+#include "http_decode.h"
+#endif
+
+#ifdef HTTP_STATS
+#include "http_stats.h"
+// Adds the cycles since the last lap to the phase
+#define HTTP_STATS_LAP(phase) do { \
+		uint64_t now = http_stats_cycles(); \
+		stats->cycles[phase] += now - clock; \
+		clock = now; \
+	} while (0)
+#else
+#define HTTP_STATS_LAP(phase)
+#endif
+
 static char* error_strs[] = 
 {
 	"No errors found",
@@ -25,6 +45,16 @@ static char* error_strs[] =
 	"Header value expected",
 	"Invalid body length (Content-Length header)",
 	"Out Of Memory",
+	"Invalid chunk size",
+	"Invalid Transfer-Encoding",
+	"Status code expected",
+	"Invalid percent-encoding",
+	"Header section too large",
+	"Too many headers",
+	"Header field too large",
+	"Body too large",
+	"Unsupported Content-Encoding",
+	"Invalid compressed body",
 	"Unknown error"
 };
 
@@ -40,364 +70,1592 @@ void http_get_error_str(uint8_t error, char* buffer, size_t len)
 	strncpy(buffer, error_strs[error], len);
 }
 
+// Zero padded to a full word so a method compares with one 64-bit load
+static const char http_method_names[HTTP_METHOD_COUNT][8] = 
+{
+	"",
+	"GET",
+	"HEAD",
+	"POST",
+	"PUT",
+	"DELETE",
+	"CONNECT",
+	"OPTIONS",
+	"TRACE",
+	"PATCH"
+};
+
+Http_Method http_method_id(const char* method, size_t len)
+{
+	if (len == 0 || len > sizeof(http_method_names[0]))
+		return HTTP_METHOD_OTHER;
+
+	uint64_t word = 0;
+	memcpy(&word, method, len);
+	for (int id = HTTP_METHOD_OTHER + 1; id < HTTP_METHOD_COUNT; ++id) {
+		uint64_t known;
+		memcpy(&known, http_method_names[id], sizeof(known));
+		if (word == known)
+			return id;
+	}
+
+	return HTTP_METHOD_OTHER;
+}
+
+const char* http_method_name(Http_Method method)
+{
+	if (method == HTTP_METHOD_OTHER || method >= HTTP_METHOD_COUNT)
+		return NULL;
+	return http_method_names[method];
+}
+
 static uint8_t http_is_whitespace(const char c)
 {
-	const char whitespace[] = " \t";
-	return strchr(whitespace, c) != NULL;
+	return http_char_class[(unsigned char)c] & HTTP_CHAR_WHITESPACE;
 }
 
 static uint8_t http_is_digit(const char c)
 {
-	const char digits[] = "0123456789";
-	return strchr(digits, c) != NULL;
+	return http_char_class[(unsigned char)c] & HTTP_CHAR_DIGIT;
 }
 
 static uint8_t http_is_alpha(const char c)
 {
-	const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
-	return strchr(alphabet, c) != NULL;
+	return http_char_class[(unsigned char)c] & HTTP_CHAR_ALPHA;
 }
 
-static uint8_t http_is_tchar(const char c)
+static uint8_t http_is_uri_char(const char c)
 {
-	const char tchars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!#$%&'*+-.^_`|~";
-	return strchr(tchars, c) != NULL;
+	return http_char_class[(unsigned char)c] & HTTP_CHAR_URI;
 }
 
-static uint8_t http_is_uri_char(const char c)
+static uint8_t http_is_scheme_char(const char c)
 {
-	const char uri_chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-._:/?#[]@!$&'()*+,;%=";
-	return strchr(uri_chars, c) != NULL;
+	return (http_char_class[(unsigned char)c] & (HTTP_CHAR_ALPHA | HTTP_CHAR_DIGIT)) || c == '+' || c == '-' || c == '.';
 }
 
-static uint8_t http_is_vchar(const char c)
-{ 
-	return (0x20 <= c && c < 0x7F) || c == 0x09;
+// unreserved, sub-delims and the '%' of pct-encoded, what a reg-name host is made of (RFC 3986, 3.2.2)
+static uint8_t http_is_reg_name_char(const char c)
+{
+	return (http_char_class[(unsigned char)c] & (HTTP_CHAR_ALPHA | HTTP_CHAR_DIGIT)) || (c && strchr("-._~%!$&'()*+,;=", c));
 }
 
-static uint8_t http_parse_token(char** ptr, char** tok, size_t* len, Arena* arena)
+static int8_t http_hex_value(const char c)
 {
-	char* start = *ptr;
-	char* it = start;
-	while (*it && http_is_tchar(*it)) ++it;
+	if (http_is_digit(c))
+		return c - '0';
+	if ('a' <= (c | 0x20) && (c | 0x20) <= 'f')
+		return (c | 0x20) - 'a' + 10;
+	return -1;
+}
 
-	*len = it - start;
-	if (*len == 0)
-		return HTTP_EMPTY_TOKEN;
+enum http_parser_stage { PARSING_START_LINE, PARSING_HEADERS, PARSING_BODY, PARSING_TRAILERS, PARSING_DONE };
+enum http_body_type { HTTP_BODY_UNKNOWN, HTTP_BODY_NONE, HTTP_BODY_FIXED, HTTP_BODY_CHUNKED, HTTP_BODY_UNTIL_CLOSE };
+
+// Everything past the start line is shared by requests and responses;
+// exactly one of request and response is set
+typedef struct {
+	Http_Request* request;
+	Http_Response* response;
+	Http_Header_Array* headers;
+	Http_Header_Array* trailers;
+	uint8_t** body;
+	size_t* body_len;
+	uint16_t* known_headers;
+} Http_Message;
+
+// Jumps to the end of a run of the class, using the structural index where the head has been indexed
+static const char* http_scan(Http_Parser* parser, const char* buffer, const char* it, const char* end, uint8_t class)
+{
+	return buffer + http_index_scan(&parser->index, buffer, it - buffer, end - buffer, class);
+}
+
+// Zero-copy mode and callbacks hand out views into the input buffer, otherwise
+// the field is copied to the arena and NUL terminated
+static uint8_t http_store_field(Http_Parser* parser, const char* start, size_t len, const char** field, Arena* arena)
+{
+	if ((parser->flags & HTTP_PARSE_ZERO_COPY) || parser->callbacks) {
+		*field = start;
+		return HTTP_SUCCESS;
+	}
 
-	*tok = arena_alloc(arena, *len + 1);
-	if (*tok == NULL)
+	char* copy = arena_alloc(arena, len + 1);
+	if (copy == NULL)
 		return HTTP_OOM;
 
-	memcpy(*tok, start, *len);
-	(*tok)[*len] = '\0';
-	*ptr = it;
+	memcpy(copy, start, len);
+	copy[len] = '\0';
+	*field = copy;
 	return HTTP_SUCCESS;
 }
 
-static uint8_t http_parse_method(char** ptr, char method[HTTP_MAX_METHOD_LEN + 1])
+static uint8_t http_parse_token(Http_Parser* parser, const char** ptr, const char* buffer, const char* end, size_t* len)
 {
-	char* start = *ptr;
-	char* it = start;
-	while (*it && http_is_tchar(*it)) ++it;
+	const char* start = buffer + parser->mark;
+	const char* it = http_scan(parser, buffer, *ptr, end, HTTP_CHAR_TCHAR);
+	*ptr = it;
 
-	size_t len = it - start;
-	if (len == 0) 
-		return HTTP_EMPTY_METHOD;
+	if (it == end)
+		return HTTP_END_OF_CONTENT;
 
-	if (len > HTTP_MAX_METHOD_LEN)
-		return HTTP_METHOD_TOO_LARGE;
+	*len = it - start;
+	if (*len == 0)
+		return HTTP_EMPTY_TOKEN;
 
-	memcpy(method, start, len);
-	method[len] = '\0';
+	return HTTP_SUCCESS;
+}
+
+static uint8_t http_parse_method(Http_Parser* parser, const char** ptr, const char* buffer, const char* end, size_t* len)
+{
+	const char* start = buffer + parser->mark;
+	const char* it = http_scan(parser, buffer, *ptr, end, HTTP_CHAR_TCHAR);
 	*ptr = it;
+
+	*len = it - start;
+	if (*len > HTTP_MAX_METHOD_LEN)
+		return HTTP_METHOD_TOO_LARGE;
+
+	if (it == end)
+		return HTTP_END_OF_CONTENT;
+
+	if (*len == 0) 
+		return HTTP_EMPTY_METHOD;
+
 	return HTTP_SUCCESS;
 }
 
-static uint8_t http_parse_target(char** ptr, char target[HTTP_MAX_TARGET_LEN + 1])
+// A host is an IP-literal in brackets (IPv6 addresses; IPvFuture is not accepted) or a reg-name,
+// which IPv4 addresses are a case of
+static uint8_t http_is_host(const char* host, uint32_t len)
 {
-	char* start = *ptr;
-	char* it = start;
-	if (*it++ != '/') 
-		return HTTP_TARGET_EXPECTED;
+	if (host[0] == '[') {
+		if (len < 3 || host[len - 1] != ']')
+			return 0;
+		for (uint32_t i = 1; i < len - 1; ++i) {
+			if (http_hex_value(host[i]) < 0 && host[i] != ':' && host[i] != '.')
+				return 0;
+		}
+		return 1;
+	}
 
-	while (*it && http_is_uri_char(*it)) ++it;
+	for (uint32_t i = 0; i < len; ++i) {
+		if (!http_is_reg_name_char(host[i]))
+			return 0;
+	}
+	return 1;
+}
 
-	size_t len = it - start;
-	if (len == 0)
-		return HTTP_EMPTY_TARGET;
-		
-	if (len > HTTP_MAX_TARGET_LEN) 
-		return HTTP_TARGET_TOO_LONG;
+// Splits the authority that ends at offset into host and port, port.offset holding the last ':' outside an IPv6 literal
+static uint8_t http_split_authority(Http_Uri* uri, const char* start, uint32_t offset)
+{
+	uri->authority.len = offset - uri->authority.offset;
+	if (uri->port.offset) {
+		uri->host.len = uri->port.offset - uri->host.offset;
+		uri->port.offset++;
+		uri->port.len = offset - uri->port.offset;
+	}
+	else {
+		uri->host.len = offset - uri->host.offset;
+	}
+
+	for (uint32_t i = 0; i < uri->port.len; ++i) {
+		if (!http_is_digit(start[uri->port.offset + i]))
+			return HTTP_TARGET_EXPECTED;
+	}
+
+	if (uri->host.len == 0 || (uri->form == HTTP_TARGET_AUTHORITY && uri->port.len == 0))
+		return HTTP_TARGET_EXPECTED;
+	if (!http_is_host(start + uri->host.offset, uri->host.len))
+		return HTTP_TARGET_EXPECTED;
 
-	memcpy(target, start, len);
-	target[len] = '\0';
-	*ptr = it;
 	return HTTP_SUCCESS;
 }
 
-static uint8_t http_parse_version(char** ptr, uint8_t* major, uint8_t* minor)
+// Validates the target and records its components in the same pass. The scheme and
+// authority are short and walked byte by byte, the path, query and fragment use the
+// vector scan, which stops at each '?' and '#'.
+static uint8_t http_parse_target(Http_Parser* parser, const char** ptr, const char* buffer, const char* end, Http_Request* req)
 {
-	char* start = *ptr;
-	char* it = start;
-	if (strncmp(it, "HTTP/", 5) != 0)
-		return HTTP_VERSION_EXPECTED;
+	enum target_machine_state { TARGET_START, PARSING_SCHEME, PARSING_SLASHES, PARSING_AUTHORITY, PARSING_PATH, PARSING_QUERY, PARSING_FRAGMENT, TARGET_END };
 
-	it += 5;
-	start = it;
-	while (*it && http_is_digit(*it)) ++it;
+	const char* start = buffer + parser->mark;
+	Http_Uri* uri = &req->uri;
+	uint8_t status = HTTP_SUCCESS;
 
-	char major_str[4];
-	size_t len = it - start;
-	if (!len || len >= sizeof(major_str))
-		return HTTP_VERSION_EXPECTED;
+	const char* it = *ptr;
+	while (it < end) {
+		switch (parser->substate) {
+			case TARGET_START:
+				memset(uri, 0, sizeof(Http_Uri));
+				if (*it == '/') {
+					uri->form = HTTP_TARGET_ORIGIN;
+					parser->substate = PARSING_PATH;
+				}
+				else if (*it == '*') {
+					uri->form = HTTP_TARGET_ASTERISK;
+					it++;
+					parser->substate = TARGET_END;
+				}
+				else if (*it == '[') {
+					// Only authority-form starts with an IPv6 literal
+					uri->form = HTTP_TARGET_AUTHORITY;
+					parser->substate = PARSING_AUTHORITY;
+				}
+				else if (http_is_scheme_char(*it)) {
+					parser->substate = PARSING_SCHEME;
+				}
+				else if (http_is_reg_name_char(*it)) {
+					// No scheme starts like this, it can only be an authority-form host
+					uri->form = HTTP_TARGET_AUTHORITY;
+					parser->substate = PARSING_AUTHORITY;
+				}
+				else if (*it == ' ') {
+					return HTTP_EMPTY_TARGET;
+				}
+				else {
+					return HTTP_TARGET_EXPECTED;
+				}
+				break;
 
-	memcpy(major_str, start, len); 
-	major_str[len] = '\0';
+			case PARSING_SCHEME:
+				// Either the scheme of absolute-form or the host of authority-form, undecided until after the ':'
+				while (it < end && http_is_scheme_char(*it))
+					it++;
+				if (it == end)
+					break;
+				if (*it != ':') {
+					// A character a scheme cannot hold, e.g. '_', makes it an authority-form host
+					if (!http_is_reg_name_char(*it))
+						return HTTP_TARGET_EXPECTED;
+					uri->form = HTTP_TARGET_AUTHORITY;
+					parser->substate = PARSING_AUTHORITY;
+					break;
+				}
+				uri->scheme.len = it++ - start;
+				parser->count = 0;
+				parser->substate = PARSING_SLASHES;
+				break;
 
-	if (*it++ != '.') 
-		return HTTP_VERSION_EXPECTED;
+			case PARSING_SLASHES:
+				if (*it != '/') {
+					if (parser->count)
+						return HTTP_TARGET_EXPECTED;
+					uri->form = HTTP_TARGET_AUTHORITY;
+					uri->port.offset = uri->scheme.len;
+					uri->scheme.len = 0;
+					parser->substate = PARSING_AUTHORITY;
+					break;
+				}
+				it++;
+				if (++parser->count < 2)
+					break;
+				if (!http_is_alpha(*start))
+					return HTTP_TARGET_EXPECTED;
+				uri->form = HTTP_TARGET_ABSOLUTE;
+				uri->authority.offset = uri->host.offset = it - start;
+				parser->count = 0;
+				parser->substate = PARSING_AUTHORITY;
+				break;
 
-	start = it;
-	while (*it && http_is_digit(*it)) ++it;
+			case PARSING_AUTHORITY:
+				// count is set while inside an IPv6 literal, whose colons are not the port separator
+				for (; it < end; ++it) {
+					if (*it == '[')
+						parser->count = 1;
+					else if (*it == ']')
+						parser->count = 0;
+					else if (*it == ':' && !parser->count)
+						uri->port.offset = it - start;
+					else if (*it == '@') {
+						uri->host.offset = it - start + 1;
+						uri->port.offset = 0;
+					}
+					else if (*it == '/' || !http_is_uri_char(*it))
+						break;
+				}
+				if (it == end)
+					break;
+
+				status = http_split_authority(uri, start, it - start);
+				if (status)
+					return status;
+				parser->count = 0;
+
+				if (uri->form == HTTP_TARGET_AUTHORITY) {
+					parser->substate = TARGET_END;
+				}
+				else if (*it == '/') {
+					uri->path.offset = it - start;
+					parser->substate = PARSING_PATH;
+				}
+				else if (*it == '?') {
+					uri->query.offset = ++it - start;
+					parser->substate = PARSING_QUERY;
+				}
+				else if (*it == '#') {
+					uri->fragment.offset = ++it - start;
+					parser->substate = PARSING_FRAGMENT;
+				}
+				else {
+					parser->substate = TARGET_END;
+				}
+				break;
+
+			case PARSING_PATH:
+				it = http_scan(parser, buffer, it, end, HTTP_CHAR_URI);
+				if (it == end)
+					break;
+				uri->path.len = it - start - uri->path.offset;
+				if (*it == '?') {
+					uri->query.offset = ++it - start;
+					parser->substate = PARSING_QUERY;
+				}
+				else if (*it == '#') {
+					uri->fragment.offset = ++it - start;
+					parser->substate = PARSING_FRAGMENT;
+				}
+				else {
+					parser->substate = TARGET_END;
+				}
+				break;
+
+			case PARSING_QUERY:
+				it = http_scan(parser, buffer, it, end, HTTP_CHAR_URI);
+				if (it == end)
+					break;
+				if (*it == '?') {
+					it++;
+					break;
+				}
+				uri->query.len = it - start - uri->query.offset;
+				if (*it == '#') {
+					uri->fragment.offset = ++it - start;
+					parser->substate = PARSING_FRAGMENT;
+				}
+				else {
+					parser->substate = TARGET_END;
+				}
+				break;
+
+			case PARSING_FRAGMENT:
+				it = http_scan(parser, buffer, it, end, HTTP_CHAR_URI);
+				if (it == end)
+					break;
+				if (*it == '?') {
+					it++;
+					break;
+				}
+				uri->fragment.len = it - start - uri->fragment.offset;
+				parser->substate = TARGET_END;
+				break;
 
-	char minor_str[4];
-	len = it - start;
-	if (!len || len >= sizeof(minor_str))
-		return HTTP_VERSION_EXPECTED;
+			case TARGET_END:
+				goto PARSE_TARGET_STOP;
+		}
+	}
 
-	memcpy(minor_str, start, len); 
-	minor_str[len] = '\0';
+	status = HTTP_END_OF_CONTENT;
 
-	*major = atoi(major_str);
-	*minor = atoi(minor_str);
+PARSE_TARGET_STOP:
 	*ptr = it;
+	// Component offsets are 32 bit
+	if ((size_t)(it - start) > UINT32_MAX)
+		return HTTP_TARGET_TOO_LONG;
+	if (status)
+		return status;
+
+	parser->substate = 0;
+	req->target_len = it - start;
 	return HTTP_SUCCESS;
 }
 
-static uint8_t http_parse_start_line(char** ptr, Http_Request* req, Arena* arena)
+const char* http_uri_part(const Http_Request* request, Http_Uri_Part part)
+{
+	return request->target + part.offset;
+}
+
+static uint8_t http_parse_version(Http_Parser* parser, const char** ptr, const char* end, uint8_t* major, uint8_t* minor)
 {
-	enum start_line_machine_state { PARSING_METHOD, FIRST_WHITESPACE, PARSING_TARGET, SECOND_WHITESPACE, PARSING_VERSION, CRLF };
-	enum start_line_machine_state state = PARSING_METHOD;
+	enum version_machine_state { PARSING_PREFIX, PARSING_MAJOR, PARSING_MINOR };
+	const char prefix[] = "HTTP/";
+	const uint8_t max_digits = 3;
+
+	const char* it = *ptr;
+	while (it < end) {
+		switch (parser->substate) {
+			case PARSING_PREFIX:
+				if (*it++ != prefix[parser->count])
+					return HTTP_VERSION_EXPECTED;
+				if (++parser->count == sizeof(prefix) - 1) {
+					parser->count = 0;
+					parser->substate++;
+				}
+				break;
+
+			case PARSING_MAJOR:
+				if (*it == '.' && parser->count) {
+					it++;
+					parser->count = 0;
+					parser->substate++;
+					break;
+				}
+				if (!http_is_digit(*it) || ++parser->count > max_digits)
+					return HTTP_VERSION_EXPECTED;
+				*major = *major * 10 + (*it++ - '0');
+				break;
+
+			case PARSING_MINOR:
+				if (!http_is_digit(*it)) {
+					if (!parser->count)
+						return HTTP_VERSION_EXPECTED;
+					parser->count = 0;
+					parser->substate = 0;
+					*ptr = it;
+					return HTTP_SUCCESS;
+				}
+				if (++parser->count > max_digits)
+					return HTTP_VERSION_EXPECTED;
+				*minor = *minor * 10 + (*it++ - '0');
+				break;
+		}
+	}
+
+	*ptr = it;
+	return HTTP_END_OF_CONTENT;
+}
+
+static uint8_t http_parse_request_line(Http_Parser* parser, const char** ptr, const char* end, const char* buffer, Http_Request* req, Arena* arena)
+{
+	enum request_line_machine_state { PARSING_METHOD, FIRST_WHITESPACE, PARSING_TARGET, SECOND_WHITESPACE, PARSING_VERSION, CR, LF };
 
 	uint8_t status = HTTP_SUCCESS;
-	char* start = *ptr;
-	char* it = start;
-	while (*it) {
-		switch (state) {
+	const char* it = *ptr;
+	while (it < end) {
+		switch (parser->state) {
 			case PARSING_METHOD:
-				status = http_parse_method(&it, req->method);
+				status = http_parse_method(parser, &it, buffer, end, &req->method_len);
+				if (status)
+					goto PARSE_REQUEST_LINE_STOP;
+
+				// Standard methods are never copied, their static name is just as good
+				req->method_id = http_method_id(buffer + parser->mark, req->method_len);
+				if (req->method_id != HTTP_METHOD_OTHER && !(parser->flags & HTTP_PARSE_ZERO_COPY))
+					req->method = http_method_names[req->method_id];
+				else
+					status = http_store_field(parser, buffer + parser->mark, req->method_len, &req->method, arena);
+				if (!status && parser->callbacks && parser->callbacks->on_method)
+					status = parser->callbacks->on_method(parser->user_data, buffer + parser->mark, req->method_len);
 				if (status)
 					return status;
-				state++;
+				parser->state++;
 				break;
 
 			case FIRST_WHITESPACE:
 				if (*it++ != ' ')
 					return HTTP_WHITESPACE_EXPECTED;
-				state++;
+				parser->mark = it - buffer;
+				parser->state++;
 				break;
 
 			case PARSING_TARGET:
-				status = http_parse_target(&it, req->target);
+				status = http_parse_target(parser, &it, buffer, end, req);
+				if (status)
+					goto PARSE_REQUEST_LINE_STOP;
+				if ((req->uri.form == HTTP_TARGET_AUTHORITY) != (req->method_id == HTTP_METHOD_CONNECT) ||
+					(req->uri.form == HTTP_TARGET_ASTERISK && req->method_id != HTTP_METHOD_OPTIONS))
+					return HTTP_TARGET_EXPECTED;
+				status = http_store_field(parser, buffer + parser->mark, req->target_len, &req->target, arena);
+				if (!status && parser->callbacks && parser->callbacks->on_target)
+					status = parser->callbacks->on_target(parser->user_data, buffer + parser->mark, req->target_len);
 				if (status)
 					return status;
-				state++;
+				parser->state++;
 				break;
 
 			case SECOND_WHITESPACE:
 				if (*it++ != ' ') 
 					return HTTP_WHITESPACE_EXPECTED;
-				state++;
+				parser->state++;
+				break;
+
+			case PARSING_VERSION:
+				status = http_parse_version(parser, &it, end, &req->major_version, &req->minor_version);
+				if (status)
+					goto PARSE_REQUEST_LINE_STOP;
+				parser->state++;
+				break;
+
+			case CR:
+				if (*it++ != '\r')
+					return HTTP_CRLF_EXPECTED;
+				parser->state++;
 				break;
 
+			case LF:
+				if (*it++ != '\n')
+					return HTTP_CRLF_EXPECTED;
+
+				parser->state = 0;
+				*ptr = it;
+				return HTTP_SUCCESS;
+		}
+	}
+
+	status = HTTP_END_OF_CONTENT;
+
+PARSE_REQUEST_LINE_STOP:
+	*ptr = it;
+	return status;
+}
+
+static uint8_t http_parse_status_line(Http_Parser* parser, const char** ptr, const char* end, const char* buffer, Http_Response* res, Arena* arena)
+{
+	enum status_line_machine_state { PARSING_VERSION, FIRST_WHITESPACE, PARSING_STATUS, SECOND_WHITESPACE, PARSING_REASON, LF };
+
+	uint8_t status = HTTP_SUCCESS;
+	const char* it = *ptr;
+	while (it < end) {
+		switch (parser->state) {
 			case PARSING_VERSION:
-				status = http_parse_version(&it, &req->major_version, &req->minor_version);
+				status = http_parse_version(parser, &it, end, &res->major_version, &res->minor_version);
+				if (status)
+					goto PARSE_STATUS_LINE_STOP;
+				parser->state++;
+				break;
+
+			case FIRST_WHITESPACE:
+				if (*it++ != ' ')
+					return HTTP_WHITESPACE_EXPECTED;
+				parser->state++;
+				break;
+
+			case PARSING_STATUS:
+				if (!http_is_digit(*it))
+					return HTTP_STATUS_EXPECTED;
+				res->status_code = res->status_code * 10 + (*it++ - '0');
+				if (++parser->count == 3) {
+					parser->count = 0;
+					parser->state++;
+				}
+				break;
+
+			case SECOND_WHITESPACE:
+				// Tolerate a missing reason phrase sent without its separator
+				if (*it == ' ')
+					it++;
+				else if (*it != '\r')
+					return HTTP_WHITESPACE_EXPECTED;
+				parser->mark = it - buffer;
+				parser->state++;
+				break;
+
+			case PARSING_REASON:
+				it = http_scan(parser, buffer, it, end, HTTP_CHAR_VCHAR);
+				if (it == end)
+					break;
+				if (*it != '\r')
+					return HTTP_CRLF_EXPECTED;
+
+				res->reason_len = it - (buffer + parser->mark);
+				status = http_store_field(parser, buffer + parser->mark, res->reason_len, &res->reason, arena);
 				if (status)
 					return status;
-				state++;
+				it++;
+				parser->state++;
 				break;
 
-			case CRLF:
-				if (*it++ != '\r' || !*it ||*it++ != '\n')
+			case LF:
+				if (*it++ != '\n')
 					return HTTP_CRLF_EXPECTED;
 
+				parser->state = 0;
 				*ptr = it;
 				return HTTP_SUCCESS;
 		}
 	}
 
+	status = HTTP_END_OF_CONTENT;
+
+PARSE_STATUS_LINE_STOP:
 	*ptr = it;
-	return HTTP_END_OF_CONTENT;
+	return status;
 }
 
-static void http_parse_ows(char** ptr)
+static void http_parse_ows(const char** ptr, const char* end)
 {
-	char* it = *ptr;
-	while (*it && http_is_whitespace(*it)) it++;
+	const char* it = *ptr;
+	while (it < end && http_is_whitespace(*it)) it++;
 	*ptr = it;
 }
 
-static uint8_t http_parse_header_value(char** ptr, char** value, size_t* len, Arena* arena)
+static uint8_t http_parse_header_value(Http_Parser* parser, const char** ptr, const char* buffer, const char* end, size_t* len)
 {
-	*value = NULL;
-	*len = 0;
+	// CR is the only byte outside vchar allowed to end the value
+	const char* start = buffer + parser->mark;
+	const char* it = http_scan(parser, buffer, *ptr, end, HTTP_CHAR_VCHAR);
+	if (it < end && *it != '\r')
+		return HTTP_INVALID_HEADER_BYTE;
+	*ptr = it;
 
-	uint8_t parsing_lf = 0;
-	char* start = *ptr;
-	char* it = start;
-	while (*it) {
-		if (parsing_lf) {
-			if (*it == '\n') {
-				it++;
-				goto PARSE_HEADER_VALUE_END;
-			}
-			else 
-				return HTTP_CRLF_EXPECTED;
-		}
-		else {
-			if (*it == '\r') 
-				parsing_lf = 1;
-			else if (!http_is_vchar(*it))
-				return HTTP_INVALID_HEADER_BYTE;
-			it++;
+	if (it == end)
+		return HTTP_END_OF_CONTENT;
+
+	// Trailing OWS is not part of the value either
+	const char* value_end = it;
+	while (value_end > start && http_is_whitespace(value_end[-1])) value_end--;
+	*len = value_end - start;
+	return HTTP_SUCCESS;
+}
+
+static uint8_t http_append_header(Http_Parser* parser, Http_Header_Array* headers, uint16_t* known_headers, Arena* arena)
+{
+	size_t index = headers->count;
+	if (index >= HTTP_INLINE_HEADERS + headers->capacity) {
+		// Spans and IDs share one allocation
+		size_t capacity = headers->capacity ? headers->capacity * 2 : HTTP_INLINE_HEADERS;
+		Http_Header_Span* spans = arena_alloc(arena, capacity * (sizeof(Http_Header_Span) + 1));
+		if (spans == NULL)
+			return HTTP_OOM;
+
+		uint8_t* ids = (uint8_t*)(spans + capacity);
+		if (headers->capacity) {
+			memcpy(spans, headers->spill_spans, headers->capacity * sizeof(Http_Header_Span));
+			memcpy(ids, headers->spill_ids, headers->capacity);
 		}
+		headers->spill_spans = spans;
+		headers->spill_ids = ids;
+		headers->capacity = capacity;
 	}
 
-	*ptr = it;
-	return HTTP_END_OF_CONTENT;
+	if (index < HTTP_INLINE_HEADERS) {
+		headers->spans[index] = parser->header;
+		headers->ids[index] = parser->header_id;
+	}
+	else {
+		headers->spill_spans[index - HTTP_INLINE_HEADERS] = parser->header;
+		headers->spill_ids[index - HTTP_INLINE_HEADERS] = parser->header_id;
+	}
+	headers->count++;
+
+	// Remember where the first header of each known kind is
+	if (known_headers && parser->header_id && !known_headers[parser->header_id] && headers->count <= UINT16_MAX)
+		known_headers[parser->header_id] = headers->count;
+
+	return HTTP_SUCCESS;
+}
+
+static uint8_t http_parse_content_length(const Http_Header* header, size_t* body_len)
+{
+	size_t digits = 0;
+	*body_len = 0;
+	while (digits < header->value_len && http_is_digit(header->value[digits])) {
+		size_t digit = header->value[digits++] - '0';
+		if (*body_len > (SIZE_MAX - digit) / 10)
+			return HTTP_INVALID_BODY_LENGTH;
+		*body_len = *body_len * 10 + digit;
+	}
+
+	size_t i = digits;
+	while (i < header->value_len && http_is_whitespace(header->value[i])) i++;
+
+	if (digits == 0 || i < header->value_len)
+		return HTTP_INVALID_BODY_LENGTH;
+
+	return HTTP_SUCCESS;
+}
+
+// Chunked must be the final transfer coding of a request (RFC 7230, 3.3.3)
+static uint8_t http_is_chunked(const Http_Header* header)
+{
+	size_t end = header->value_len;
+	while (end > 0 && http_is_whitespace(header->value[end - 1])) end--;
+
+	const size_t len = sizeof("chunked") - 1;
+	if (end < len || strncasecmp(header->value + end - len, "chunked", len))
+		return 0;
+
+	size_t start = end - len;
+	while (start > 0 && http_is_whitespace(header->value[start - 1])) start--;
+	return start == 0 || header->value[start - 1] == ',';
+}
+
+// Headers framing the body as they appear in the section, which in callback
+// mode is only valid during the call that completed it
+static Http_Header http_span_header(const char* section, const Http_Header_Span* span)
+{
+	return (Http_Header) {
+		.name = section + span->name,
+		.value = section + span->value,
+		.name_len = span->name_len,
+		.value_len = span->value_len
+	};
+}
+
+// Hands a header to on_header, keeping only one of each header that frames the body.
+// Repeats are checked here, against the one kept, as http_select_body_type cannot see them.
+static uint8_t http_emit_header(Http_Parser* parser, const char* buffer, Http_Header_Array* headers, uint16_t* known_headers, Arena* arena)
+{
+	if (parser->callbacks->on_header) {
+		const char* section = buffer + parser->section;
+		uint8_t status = parser->callbacks->on_header(parser->user_data, section + parser->header.name, parser->header.name_len,
+			section + parser->header.value, parser->header.value_len);
+		if (status)
+			return status;
+	}
+
+	uint8_t id = parser->header_id;
+	if (known_headers == NULL || (id != HTTP_HEADER_CONTENT_LENGTH && id != HTTP_HEADER_TRANSFER_ENCODING && id != HTTP_HEADER_CONTENT_ENCODING))
+		return HTTP_SUCCESS;
+
+	// At most three are kept, which always fit inline
+	if (!known_headers[id])
+		return http_append_header(parser, headers, known_headers, arena);
+
+	const char* section = buffer + parser->section;
+	Http_Header_Span* kept = &headers->spans[known_headers[id] - 1];
+	Http_Header header = http_span_header(section, &parser->header);
+	Http_Header previous = http_span_header(section, kept);
+	if (id == HTTP_HEADER_CONTENT_LENGTH) {
+		size_t len, previous_len;
+		if (http_parse_content_length(&header, &len) || http_parse_content_length(&previous, &previous_len) || len != previous_len)
+			return HTTP_INVALID_BODY_LENGTH;
+	}
+	else if (id == HTTP_HEADER_TRANSFER_ENCODING) {
+		// Only the last line may end in chunked, keep that one
+		if (http_is_chunked(&previous))
+			return HTTP_INVALID_TRANSFER_ENCODING;
+		*kept = parser->header;
+	}
+#ifdef HTTP_WITH_ZLIB
+	else if (parser->decoder) {
+		// A repeated Content-Encoding stacks codings, which the decoder does not undo
+		return HTTP_UNSUPPORTED_ENCODING;
+	}
+#endif
 
-PARSE_HEADER_VALUE_END:
-	*len = it - start - 1;
-	*value = arena_alloc(arena, *len + 1);
-	memcpy(*value, start, *len);
-	(*value)[*len] = '\0';
-	*ptr = it;
 	return HTTP_SUCCESS;
+}
+
+// Called once the section is complete. Copy mode takes the whole section in a
+// single arena copy and terminates each name (at its ':') and value (at its CR or trailing OWS).
+static uint8_t http_store_headers(Http_Parser* parser, const char* buffer, const char* end, Http_Header_Array* headers, Arena* arena)
+{
+	if ((parser->flags & HTTP_PARSE_ZERO_COPY) || parser->callbacks) {
+		headers->base = buffer + parser->section;
+		return HTTP_SUCCESS;
+	}
 
+	if (headers->count == 0)
+		return HTTP_SUCCESS;
+
+	size_t len = end - buffer - parser->section;
+	char* copy = arena_alloc(arena, len);
+	if (copy == NULL)
+		return HTTP_OOM;
+	memcpy(copy, buffer + parser->section, len);
+
+	for (size_t i = 0; i < headers->count; ++i) {
+		const Http_Header_Span* span = i < HTTP_INLINE_HEADERS ? &headers->spans[i] : &headers->spill_spans[i - HTTP_INLINE_HEADERS];
+		copy[span->name + span->name_len] = '\0';
+		copy[span->value + span->value_len] = '\0';
+	}
+
+	headers->base = copy;
+	return HTTP_SUCCESS;
 }
 
-static uint8_t http_parse_header(char** ptr, Http_Header_Array* headers, Arena* arena)
+// Where scanning has to stop for a section that starts at offset to stay within
+// limit. Parsing that runs into it short of the real end has crossed the limit.
+static const char* http_limit_end(const char* buffer, size_t len, size_t offset, size_t limit)
 {
-	enum header_machine_state { PARSING_NAME, PARSING_COLON, PARSING_OWS, PARSING_VALUE };
-	enum header_machine_state state = PARSING_NAME;
+	if (limit && len - offset > limit)
+		return buffer + offset + limit;
+	return buffer + len;
+}
 
-	char* header_name = NULL;
-	size_t header_name_len;
-	char* header_value = NULL;
-	size_t header_value_len;
+static uint8_t http_parse_header(Http_Parser* parser, const char** ptr, const char* end, const char* buffer, Http_Header_Array* headers, uint16_t* known_headers, Arena* arena)
+{
+	enum header_machine_state { PARSING_NAME, PARSING_COLON, PARSING_OWS, PARSING_VALUE, PARSING_LF };
 
 	uint8_t status = HTTP_SUCCESS;
-	char* start = *ptr;
-	char* it = start;
-	while (*it) {
-		switch (state) {
+	size_t len = 0;
+	const char* it = *ptr;
+	while (it < end) {
+		switch (parser->substate) {
 			case PARSING_NAME:
-				status = http_parse_token(&it, &header_name, &header_name_len, arena);
+				status = http_parse_token(parser, &it, buffer, end, &len);
+				if (status == HTTP_END_OF_CONTENT)
+					goto PARSE_HEADER_STOP;
 				if (status)
 					return HTTP_HEADER_EXPECTED;
-				state++;
+				parser->header_id = http_header_id(buffer + parser->mark, len);
+				parser->header.name = parser->mark - parser->section;
+				parser->header.name_len = len;
+				parser->substate++;
 				break;
 
 			case PARSING_COLON:
 				if (*it++ != ':')
 					return HTTP_COLON_EXPECTED;
-				state++;
+				parser->substate++;
 				break;
 
 			case PARSING_OWS:
-				http_parse_ows(&it);
-				state++;
+				http_parse_ows(&it, end);
+				if (it == end)
+					break;
+				parser->mark = it - buffer;
+				parser->substate++;
 				break;
 
 			case PARSING_VALUE:
-				status = http_parse_header_value(&it, &header_value, &header_value_len, arena); 
+				status = http_parse_header_value(parser, &it, buffer, end, &len); 
+				if (status == HTTP_END_OF_CONTENT)
+					goto PARSE_HEADER_STOP;
 				if (status)
 					return HTTP_HEADER_VALUE_EXPECTED;
+				// Offsets are 32 bit, the CR ending the value must be addressable too
+				if ((size_t)(it - buffer) - parser->section >= UINT32_MAX)
+					return HTTP_HEADERS_TOO_LARGE;
+				parser->header.value = parser->mark - parser->section;
+				parser->header.value_len = len;
+				it++;
+				parser->substate++;
+				break;
+
+			case PARSING_LF:
+				if (*it++ != '\n')
+					return HTTP_HEADER_VALUE_EXPECTED;
 
-				Http_Header header = {
-					.name = header_name,
-					.value = header_value
-				};
-				da_append(headers, header, arena);
+				if (parser->callbacks)
+					status = http_emit_header(parser, buffer, headers, known_headers, arena);
+				else
+					status = http_append_header(parser, headers, known_headers, arena);
+				if (status)
+					return status;
 
+				parser->substate = 0;
 				*ptr = it;
 				return HTTP_SUCCESS;
 		}
 	}
 
+	status = HTTP_END_OF_CONTENT;
+
+PARSE_HEADER_STOP:
 	*ptr = it;
-	return HTTP_END_OF_CONTENT;
+	return status;
 }
 
-static uint8_t http_parse_headers(char** ptr, Http_Request* req, Arena* arena)
+static uint8_t http_parse_headers(Http_Parser* parser, const char** ptr, const char* end, const char* buffer, Http_Header_Array* headers, uint16_t* known_headers, Arena* arena)
 {
-	uint8_t parsing_lf = 0;
-	char* it = *ptr;
-	while (*it) {
-		if (parsing_lf) {
-			if (*it == '\n') {
-				*ptr = ++it;
-				return HTTP_SUCCESS;
+	enum headers_machine_state { PARSING_LINE_START, PARSING_HEADER, PARSING_FINAL_LF };
+
+	size_t max_headers = parser->limits->max_headers;
+	size_t max_header_size = parser->limits->max_header_size;
+	const char* it = *ptr;
+	while (it < end) {
+		switch (parser->state) {
+			case PARSING_LINE_START:
+				if (*it == '\r') {
+					it++;
+					parser->state = PARSING_FINAL_LF;
+				}
+				else {
+					if (max_headers && parser->fields >= max_headers)
+						return HTTP_TOO_MANY_HEADERS;
+					parser->fields++;
+					// The name starts the line, its offset marks the line until the name is parsed
+					parser->mark = it - buffer;
+					parser->header.name = parser->mark - parser->section;
+					parser->state = PARSING_HEADER;
+				}
+				break;
+
+			case PARSING_HEADER: {
+				const char* line_end = http_limit_end(buffer, end - buffer, parser->section + parser->header.name, max_header_size);
+				uint8_t status = http_parse_header(parser, &it, line_end, buffer, headers, known_headers, arena);
+				if (status == HTTP_END_OF_CONTENT && line_end != end)
+					status = HTTP_HEADER_FIELD_TOO_LARGE;
+				if (status) {
+					*ptr = it;
+					return status;
+				}
+				parser->state = PARSING_LINE_START;
+				break;
 			}
-			else
-				return HTTP_CRLF_EXPECTED;
-		}
-		else if (*it == '\r') {
-			parsing_lf = 1;
-			it++;
+
+			case PARSING_FINAL_LF:
+				if (*it++ != '\n')
+					return HTTP_CRLF_EXPECTED;
+
+				parser->state = 0;
+				*ptr = it;
+				return http_store_headers(parser, buffer, it, headers, arena);
 		}
-		else {
-			uint8_t status = http_parse_header(&it, &req->headers, arena);
-			if (status)
-				return status;
+	}
+
+	*ptr = it;
+	return HTTP_END_OF_CONTENT;
+}
+
+Http_Header http_header_at(const Http_Header_Array* headers, size_t index)
+{
+	if (index >= headers->count)
+		return (Http_Header) {0};
+
+	const Http_Header_Span* span;
+	Http_Header_Id id;
+	if (index < HTTP_INLINE_HEADERS) {
+		span = &headers->spans[index];
+		id = headers->ids[index];
+	}
+	else {
+		span = &headers->spill_spans[index - HTTP_INLINE_HEADERS];
+		id = headers->spill_ids[index - HTTP_INLINE_HEADERS];
+	}
+
+	return (Http_Header) {
+		.name = headers->base + span->name,
+		.value = headers->base + span->value,
+		.name_len = span->name_len,
+		.value_len = span->value_len,
+		.id = id
+	};
+}
+
+static Http_Header http_find_header(const Http_Header_Array* headers, const uint16_t* known_headers, Http_Header_Id id)
+{
+	uint16_t index = known_headers[id];
+	return index ? http_header_at(headers, index - 1) : (Http_Header) {0};
+}
+
+// Hands body data to the callbacks, or appends it to the body kept in the arena
+static uint8_t http_store_body(Http_Parser* parser, const char* data, size_t len, Http_Message* msg, Arena* arena)
+{
+	// An empty piece (Content-Length: 0) may come before there is any body to append to
+	if (len == 0)
+		return HTTP_SUCCESS;
+
+	if (parser->callbacks) {
+		*msg->body_len += len;
+		if (parser->callbacks->on_body_chunk)
+			return parser->callbacks->on_body_chunk(parser->user_data, data, len);
+		return HTTP_SUCCESS;
+	}
+
+	if (parser->on_body) {
+		parser->on_body(parser->user_data, data, len);
+		*msg->body_len += len;
+		return HTTP_SUCCESS;
+	}
+
+	if (*msg->body_len + len > parser->body_capacity) {
+		size_t capacity = parser->body_capacity ? parser->body_capacity * 2 : len;
+		if (capacity < *msg->body_len + len)
+			capacity = *msg->body_len + len;
+
+		*msg->body = arena_realloc(arena, *msg->body, parser->body_capacity, capacity);
+		if (*msg->body == NULL)
+			return HTTP_OOM;
+		parser->body_capacity = capacity;
+	}
+
+	memcpy(*msg->body + *msg->body_len, data, len);
+	*msg->body_len += len;
+	return HTTP_SUCCESS;
+}
+
+#ifdef HTTP_WITH_ZLIB
+typedef struct {
+	Http_Parser* parser;
+	Http_Message* msg;
+	Arena* arena;
+} Http_Body_Sink;
+
+static uint8_t http_sink_body(void* context, const char* data, size_t len)
+{
+	Http_Body_Sink* sink = context;
+	return http_store_body(sink->parser, data, len, sink->msg, sink->arena);
+}
+#endif
+
+// Passes body data as sent through the decoder, if any, on to http_store_body
+static uint8_t http_append_body(Http_Parser* parser, const char* data, size_t len, Http_Message* msg, Arena* arena)
+{
+	size_t max_body = parser->limits->max_body;
+	if (max_body && len > max_body - parser->body_read)
+		return HTTP_BODY_TOO_LARGE;
+	parser->body_read += len;
+
+#ifdef HTTP_WITH_ZLIB
+	if (parser->decoder) {
+		Http_Body_Sink sink = { parser, msg, arena };
+		return http_decoder_write(parser->decoder, data, len, http_sink_body, &sink, arena);
+	}
+#endif
+
+	return http_store_body(parser, data, len, msg, arena);
+}
+
+static uint8_t http_parse_fixed_body(Http_Parser* parser, const char** ptr, const char* end, Http_Message* msg, Arena* arena)
+{
+	// Copy whatever part of the body is available now, the rest comes with later chunks
+	size_t available = end - *ptr;
+	if (available > parser->body_left)
+		available = parser->body_left;
+
+	uint8_t status = http_append_body(parser, *ptr, available, msg, arena);
+	if (status)
+		return status;
+
+	parser->body_left -= available;
+	*ptr += available;
+
+	if (parser->body_left)
+		return HTTP_END_OF_CONTENT;
+
+	return HTTP_SUCCESS;
+}
+
+static uint8_t http_parse_chunked_body(Http_Parser* parser, const char** ptr, const char* end, const char* buffer, Http_Message* msg, Arena* arena)
+{
+	enum chunk_machine_state { PARSING_SIZE, PARSING_EXTENSION, PARSING_SIZE_LF, PARSING_DATA, PARSING_DATA_CR, PARSING_DATA_LF };
+
+	uint8_t status = HTTP_SUCCESS;
+	const char* it = *ptr;
+	while (it < end) {
+		switch (parser->state) {
+			case PARSING_SIZE: {
+				int8_t digit = http_hex_value(*it);
+				if (digit < 0) {
+					if (!parser->count || (*it != ';' && *it != '\r' && !http_is_whitespace(*it)))
+						return HTTP_INVALID_CHUNK_SIZE;
+					parser->state = PARSING_EXTENSION;
+					break;
+				}
+				if (parser->body_left > (SIZE_MAX >> 4))
+					return HTTP_INVALID_CHUNK_SIZE;
+				parser->body_left = (parser->body_left << 4) | digit;
+				// Refused while the size is still being read, not once the data arrives
+				if (parser->limits->max_body && parser->body_left > parser->limits->max_body - parser->body_read)
+					return HTTP_BODY_TOO_LARGE;
+				parser->count = 1;
+				it++;
+				break;
+			}
+
+			case PARSING_EXTENSION:
+				// Chunk extensions carry nothing we use, skip them up to the CR
+				it = http_scan(parser, buffer, it, end, HTTP_CHAR_VCHAR);
+				if (it == end)
+					break;
+				if (*it++ != '\r')
+					return HTTP_INVALID_CHUNK_SIZE;
+				parser->state = PARSING_SIZE_LF;
+				break;
+
+			case PARSING_SIZE_LF:
+				if (*it++ != '\n')
+					return HTTP_CRLF_EXPECTED;
+				parser->count = 0;
+				if (parser->body_left == 0) {
+					parser->state = 0;
+					*ptr = it;
+					return HTTP_SUCCESS;
+				}
+				parser->state = PARSING_DATA;
+				break;
+
+			case PARSING_DATA:
+				status = http_parse_fixed_body(parser, &it, end, msg, arena);
+				if (status)
+					goto PARSE_CHUNKED_BODY_STOP;
+				parser->state = PARSING_DATA_CR;
+				break;
+
+			case PARSING_DATA_CR:
+				if (*it++ != '\r')
+					return HTTP_CRLF_EXPECTED;
+				parser->state = PARSING_DATA_LF;
+				break;
+
+			case PARSING_DATA_LF:
+				if (*it++ != '\n')
+					return HTTP_CRLF_EXPECTED;
+				parser->state = PARSING_SIZE;
+				break;
 		}
 	}
 
+	status = HTTP_END_OF_CONTENT;
+
+PARSE_CHUNKED_BODY_STOP:
+	*ptr = it;
+	return status;
+}
+
+static uint8_t http_parse_until_close_body(Http_Parser* parser, const char** ptr, const char* end, Http_Message* msg, Arena* arena)
+{
+	uint8_t status = http_append_body(parser, *ptr, end - *ptr, msg, arena);
+	if (status)
+		return status;
+
+	// Only http_parser_finish can tell the body is over
+	*ptr = end;
 	return HTTP_END_OF_CONTENT;
 }
 
-static uint8_t http_parse_body(char** ptr, Http_Request* req, Arena* arena)
+// Message body length rules of RFC 7230, 3.3.3
+static uint8_t http_select_body_type(Http_Parser* parser, Http_Message* msg, Arena* arena)
 {
-	size_t body_len = 0;
-	for (int i = 0; i < req->headers.count; ++i) {
-		if (!strcasecmp(req->headers.items[i].name, "CONTENT-LENGTH")) {
-			body_len = atoi(req->headers.items[i].value);
-			break;
+	if (msg->response) {
+		uint16_t code = msg->response->status_code;
+		if ((parser->flags & HTTP_PARSE_HEAD_RESPONSE) || (code >= 100 && code < 200) || code == 204 || code == 304) {
+			parser->body_type = HTTP_BODY_NONE;
+			return HTTP_SUCCESS;
 		}
 	}
 
-	if (body_len == 0)
-		return HTTP_INVALID_BODY_LENGTH;
+	uint8_t decoding = 0;
+#ifdef HTTP_WITH_ZLIB
+	if (parser->decoder) {
+		Http_Header content_encoding = http_find_header(msg->headers, msg->known_headers, HTTP_HEADER_CONTENT_ENCODING);
+		uint8_t status = http_decoder_start(parser->decoder, &content_encoding, parser->limits->max_body);
+		if (status)
+			return status;
+		// Each line lists codings of its own, a repeat stacks them as "gzip, gzip" on one line would
+		uint16_t kept = msg->known_headers[HTTP_HEADER_CONTENT_ENCODING];
+		for (size_t i = kept; kept && i < msg->headers->count; ++i) {
+			if (http_header_at(msg->headers, i).id == HTTP_HEADER_CONTENT_ENCODING)
+				return HTTP_UNSUPPORTED_ENCODING;
+		}
+		decoding = parser->decoder->coding != HTTP_CODING_IDENTITY;
+	}
+#endif
+
+	Http_Header content_length = http_find_header(msg->headers, msg->known_headers, HTTP_HEADER_CONTENT_LENGTH);
+	Http_Header transfer_encoding = http_find_header(msg->headers, msg->known_headers, HTTP_HEADER_TRANSFER_ENCODING);
+
+	// Repeated framing headers are how requests get smuggled past a proxy that reads
+	// another one of them: every Transfer-Encoding line counts, with chunked only ever
+	// last, and repeated Content-Lengths have to agree
+	uint16_t first = msg->known_headers[HTTP_HEADER_TRANSFER_ENCODING];
+	for (size_t i = first; first && i < msg->headers->count; ++i) {
+		Http_Header header = http_header_at(msg->headers, i);
+		if (header.id != HTTP_HEADER_TRANSFER_ENCODING)
+			continue;
+		if (http_is_chunked(&transfer_encoding))
+			return HTTP_INVALID_TRANSFER_ENCODING;
+		transfer_encoding = header;
+	}
+
+	if (transfer_encoding.name) {
+		// Both framings at once is a request smuggling vector, refuse it
+		if (content_length.name)
+			return HTTP_INVALID_TRANSFER_ENCODING;
+
+		if (http_is_chunked(&transfer_encoding))
+			parser->body_type = HTTP_BODY_CHUNKED;
+		else if (msg->response)
+			parser->body_type = HTTP_BODY_UNTIL_CLOSE;
+		else
+			return HTTP_INVALID_TRANSFER_ENCODING;
+	}
+	else if (content_length.name) {
+		uint8_t status = http_parse_content_length(&content_length, &parser->body_left);
+		if (status)
+			return status;
+		first = msg->known_headers[HTTP_HEADER_CONTENT_LENGTH];
+		for (size_t i = first; i < msg->headers->count; ++i) {
+			Http_Header header = http_header_at(msg->headers, i);
+			size_t len;
+			if (header.id == HTTP_HEADER_CONTENT_LENGTH && (http_parse_content_length(&header, &len) || len != parser->body_left))
+				return HTTP_INVALID_BODY_LENGTH;
+		}
+		if (parser->limits->max_body && parser->body_left > parser->limits->max_body)
+			return HTTP_BODY_TOO_LARGE;
+
+		// Known size, reserve it once instead of growing. Decompressed, the size is anyone's guess.
+		if (parser->body_left && !parser->on_body && !parser->callbacks && !decoding) {
+			*msg->body = arena_alloc(arena, parser->body_left);
+			if (*msg->body == NULL)
+				return HTTP_OOM;
+			parser->body_capacity = parser->body_left;
+		}
+		parser->body_type = HTTP_BODY_FIXED;
+	}
+	else {
+		// A request without framing headers has no body, a response runs until the connection closes
+		parser->body_type = msg->response ? HTTP_BODY_UNTIL_CLOSE : HTTP_BODY_NONE;
+	}
 
-	req->body_len = body_len;
-	req->body = arena_alloc(arena, body_len);
-	memcpy(req->body, *ptr, body_len);
-	*ptr += body_len;
 	return HTTP_SUCCESS;
 }
 
-uint8_t http_parse_request(char* buffer, size_t len, Http_Request* request, Arena* arena)
+static uint8_t http_parse_body(Http_Parser* parser, const char** ptr, const char* end, const char* buffer, Http_Message* msg, Arena* arena)
 {
+	if (parser->body_type == HTTP_BODY_UNKNOWN) {
+		uint8_t status = http_select_body_type(parser, msg, arena);
+		if (status)
+			return status;
+	}
+
+	uint8_t status;
+	switch (parser->body_type) {
+		case HTTP_BODY_FIXED:
+			status = http_parse_fixed_body(parser, ptr, end, msg, arena);
+			break;
+		case HTTP_BODY_CHUNKED:
+			status = http_parse_chunked_body(parser, ptr, end, buffer, msg, arena);
+			break;
+		case HTTP_BODY_UNTIL_CLOSE:
+			return http_parse_until_close_body(parser, ptr, end, msg, arena);
+		default:
+			return HTTP_SUCCESS;
+	}
+
+#ifdef HTTP_WITH_ZLIB
+	if (status == HTTP_SUCCESS && parser->decoder)
+		status = http_decoder_end(parser->decoder);
+#endif
+	return status;
+}
+
+const Http_Limits http_default_limits = {
+	.max_head = HTTP_DEFAULT_MAX_HEAD,
+	.max_headers = HTTP_DEFAULT_MAX_HEADERS,
+	.max_header_size = HTTP_DEFAULT_MAX_HEADER_SIZE,
+	.max_body = HTTP_DEFAULT_MAX_BODY
+};
+
+void http_parser_init(Http_Parser* parser, uint8_t flags)
+{
+	// The index bitmaps are only read up to index.blocks, no need to clear them
+	memset(parser, 0, offsetof(Http_Parser, index));
+	parser->index.blocks = 0;
+	parser->index.complete = 0;
+	parser->flags = flags;
+	parser->limits = &http_default_limits;
+}
+
+void http_parser_next(Http_Parser* parser)
+{
+	memset(&parser->stage, 0, offsetof(Http_Parser, index) - offsetof(Http_Parser, stage));
+	parser->mark = parser->pos;
+	parser->start = parser->pos;
+	// The blocks indexed so far stay valid, indexing goes on from the next head
+	parser->index.complete = 0;
+}
+
+#ifdef HTTP_STATS
+// Arena bytes in use up to a checkpoint, counted the way arena_used counts them
+static size_t http_stats_arena_offset(const Arena* arena, const unsigned char* checkpoint)
+{
+	size_t used = 0;
+	for (Arena_Block* block = arena->first; block != NULL; block = block->next) {
+		if (block->data <= checkpoint && checkpoint <= block->data + block->capacity)
+			return used + (checkpoint - block->data);
+		used += block->capacity;
+	}
+	return 0;
+}
+
+static void http_stats_record(Http_Stats* stats, const Http_Parser* parser, size_t start, uint8_t status, const Arena* arena)
+{
+	stats->runs++;
+	stats->bytes += parser->pos - start;
+	if (status == HTTP_END_OF_CONTENT)
+		return;
+	if (status) {
+		stats->errors[status]++;
+		return;
+	}
+
+	// Lines parsed rather than headers stored, which callbacks leave at none
+	uint64_t headers = parser->head_fields + parser->fields;
+	stats->messages++;
+	stats->headers += headers;
+	if (headers > stats->max_headers)
+		stats->max_headers = headers;
+	if (arena)
+		stats->arena_bytes += arena_used(arena) - http_stats_arena_offset(arena, parser->checkpoint);
+}
+#endif
+
+// Clears what a message wrote to its headers rather than the whole array, and
+// only the known header slots it set. Spilled headers go with the arena.
+static void http_headers_clear(Http_Header_Array* headers, uint16_t* known_headers)
+{
+	if (known_headers) {
+		for (size_t i = 0; i < headers->count; ++i)
+			known_headers[i < HTTP_INLINE_HEADERS ? headers->ids[i] : headers->spill_ids[i - HTTP_INLINE_HEADERS]] = 0;
+	}
+	headers->base = NULL;
+	headers->count = 0;
+	headers->capacity = 0;
+	headers->spill_spans = NULL;
+	headers->spill_ids = NULL;
+}
+
+static void http_request_clear(Http_Request* request)
+{
+	memset(request, 0, offsetof(Http_Request, headers));
+	http_headers_clear(&request->headers, request->known_headers);
+	http_headers_clear(&request->trailers, NULL);
+	request->body = NULL;
+	request->body_len = 0;
+}
+
+static void http_response_clear(Http_Response* response)
+{
+	memset(response, 0, offsetof(Http_Response, headers));
+	http_headers_clear(&response->headers, response->known_headers);
+	http_headers_clear(&response->trailers, NULL);
+	response->body = NULL;
+	response->body_len = 0;
+}
+
+static uint8_t http_parser_run(Http_Parser* parser, const char* buffer, size_t len, Http_Message* msg, Arena* arena)
+{
+	if (parser->error)
+		return parser->error;
+
+#ifdef HTTP_STATS
+	Http_Stats* stats = http_stats_thread();
+	uint64_t clock = http_stats_cycles();
+	size_t start = parser->pos;
+#endif
+
+	if (parser->checkpoint == NULL && arena)
+		parser->checkpoint = arena_checkpoint(arena);
+
 	uint8_t status = HTTP_SUCCESS;
-	unsigned char* checkpoint = arena_checkpoint(arena);
+	const char* it = buffer + parser->pos;
+	const char* end = buffer + len;
+	const char* head_end = http_limit_end(buffer, len, parser->start, parser->limits->max_head);
 
-	status = http_parse_start_line(&buffer, request, arena);
-	if (status) 
-		goto HTTP_PARSE_ERROR;
+	if (parser->stage < PARSING_BODY && !parser->index.complete) {
+		http_index_update(&parser->index, buffer, parser->start, head_end - buffer);
+		HTTP_STATS_LAP(HTTP_PHASE_INDEX);
+	}
+	switch (parser->stage) {
+		case PARSING_START_LINE:
+			if (msg->request)
+				status = http_parse_request_line(parser, &it, head_end, buffer, msg->request, arena);
+			else
+				status = http_parse_status_line(parser, &it, head_end, buffer, msg->response, arena);
+			HTTP_STATS_LAP(HTTP_PHASE_START_LINE);
+			if (status == HTTP_END_OF_CONTENT && head_end != end)
+				status = HTTP_HEADERS_TOO_LARGE;
+			if (status)
+				break;
+			parser->section = it - buffer;
+			parser->stage++;
+			// fallthrough
+
+		case PARSING_HEADERS:
+			status = http_parse_headers(parser, &it, head_end, buffer, msg->headers, msg->known_headers, arena);
+			HTTP_STATS_LAP(HTTP_PHASE_HEADERS);
+			if (status == HTTP_END_OF_CONTENT && head_end != end)
+				status = HTTP_HEADERS_TOO_LARGE;
+			if (status == HTTP_SUCCESS && parser->callbacks && parser->callbacks->on_headers_complete)
+				status = parser->callbacks->on_headers_complete(parser->user_data);
+			if (status)
+				break;
+			parser->stage++;
+			// fallthrough
 
-	status = http_parse_headers(&buffer, request, arena);
-	if (status) 
-		goto HTTP_PARSE_ERROR;
+		case PARSING_BODY:
+			status = http_parse_body(parser, &it, end, buffer, msg, arena);
+			HTTP_STATS_LAP(HTTP_PHASE_BODY);
+			if (status)
+				break;
+			parser->section = it - buffer;
+			parser->head_fields = parser->fields;
+			parser->fields = 0;
+			parser->stage++;
+			// fallthrough
+
+		case PARSING_TRAILERS:
+			if (parser->body_type == HTTP_BODY_CHUNKED) {
+				// Trailers are held to the same limits as the head
+				const char* trailers_end = http_limit_end(buffer, len, parser->section, parser->limits->max_head);
+				status = http_parse_headers(parser, &it, trailers_end, buffer, msg->trailers, NULL, arena);
+				HTTP_STATS_LAP(HTTP_PHASE_BODY);
+				if (status == HTTP_END_OF_CONTENT && trailers_end != end)
+					status = HTTP_HEADERS_TOO_LARGE;
+				if (status)
+					break;
+			}
+			parser->stage++;
+			// fallthrough
 
-	status = http_parse_body(&buffer, request, arena);
-	if (status) 
-		goto HTTP_PARSE_ERROR;
+		case PARSING_DONE:
+			break;
+	}
+
+	parser->pos = it - buffer;
+#ifdef HTTP_STATS
+	http_stats_record(stats, parser, start, status, arena);
+#endif
+	if (status == HTTP_SUCCESS || status == HTTP_END_OF_CONTENT)
+		return status;
+
+	if (msg->request)
+		http_request_clear(msg->request);
+	else
+		http_response_clear(msg->response);
+	arena_rollback(arena, parser->checkpoint);
+	parser->error = status;
+	return status;
+}
+
+uint8_t http_parser_execute(Http_Parser* parser, const char* buffer, size_t len, Http_Request* request, Arena* arena)
+{
+	Http_Message msg = {
+		.request = request,
+		.headers = &request->headers,
+		.trailers = &request->trailers,
+		.body = &request->body,
+		.body_len = &request->body_len,
+		.known_headers = request->known_headers
+	};
+	return http_parser_run(parser, buffer, len, &msg, arena);
+}
+
+uint8_t http_parser_execute_response(Http_Parser* parser, const char* buffer, size_t len, Http_Response* response, Arena* arena)
+{
+	Http_Message msg = {
+		.response = response,
+		.headers = &response->headers,
+		.trailers = &response->trailers,
+		.body = &response->body,
+		.body_len = &response->body_len,
+		.known_headers = response->known_headers
+	};
+	return http_parser_run(parser, buffer, len, &msg, arena);
+}
+
+Http_Header http_request_header(const Http_Request* request, Http_Header_Id id)
+{
+	if (id == HTTP_HEADER_UNKNOWN || id >= HTTP_HEADER_ID_COUNT)
+		return (Http_Header) {0};
+	return http_find_header(&request->headers, request->known_headers, id);
+}
+
+Http_Header http_response_header(const Http_Response* response, Http_Header_Id id)
+{
+	if (id == HTTP_HEADER_UNKNOWN || id >= HTTP_HEADER_ID_COUNT)
+		return (Http_Header) {0};
+	return http_find_header(&response->headers, response->known_headers, id);
+}
+
+uint8_t http_header_map(const Http_Header_Array* headers, hashtable_t* map, Arena* arena)
+{
+	if (!hashtable_init(map, headers->count, HASHTABLE_CASE_INSENSITIVE, arena))
+		return HTTP_OOM;
+
+	// Inserted last to first so the first of repeated headers wins
+	for (size_t i = headers->count; i > 0; --i) {
+		Http_Header header = http_header_at(headers, i - 1);
+		if (!hashtable_put_n(map, header.name, header.name_len, (void*)(uintptr_t)i))
+			return HTTP_OOM;
+	}
 
 	return HTTP_SUCCESS;
+}
+
+uint8_t http_parser_finish(Http_Parser* parser)
+{
+	if (parser->error)
+		return parser->error;
+
+	if (parser->stage == PARSING_BODY && parser->body_type == HTTP_BODY_UNTIL_CLOSE) {
+#ifdef HTTP_WITH_ZLIB
+		if (parser->decoder && (parser->error = http_decoder_end(parser->decoder)))
+			return parser->error;
+#endif
+		parser->stage = PARSING_DONE;
+	}
+
+	return parser->stage == PARSING_DONE ? HTTP_SUCCESS : HTTP_END_OF_CONTENT;
+}
+
+void http_request_reset(Http_Request* request, Arena* arena)
+{
+	size_t capacity = request->headers.capacity;
+	http_request_clear(request);
+	arena_reset(arena);
+
+	// Spilled headers start out as large as the last request needed them, so a
+	// client that always sends many headers does not regrow them on every request
+	if (capacity) {
+		Http_Header_Span* spans = arena_alloc(arena, capacity * (sizeof(Http_Header_Span) + 1));
+		if (spans) {
+			request->headers.spill_spans = spans;
+			request->headers.spill_ids = (uint8_t*)(spans + capacity);
+			request->headers.capacity = capacity;
+		}
+	}
+}
+
+uint8_t http_parse_request(const char* buffer, size_t len, Http_Request* request, Arena* arena)
+{
+	Http_Parser parser;
+	http_parser_init(&parser, 0);
+
+	uint8_t status = http_parser_execute(&parser, buffer, len, request, arena);
+	if (status == HTTP_END_OF_CONTENT) {
+		http_request_clear(request);
+		arena_rollback(arena, parser.checkpoint);
+	}
+
+	return status;
+}
+
+size_t http_parse_requests(const char* buffer, size_t len, Http_Request* requests, size_t max, uint8_t flags, size_t* consumed, uint8_t* status, Arena* arena)
+{
+	Http_Parser parser;
+	http_parser_init(&parser, flags);
+
+	size_t count = 0;
+	*status = HTTP_SUCCESS;
+	*consumed = 0;
+	while (count < max && parser.pos < len) {
+		Http_Request* request = &requests[count];
+		memset(request, 0, sizeof(Http_Request));
+
+		*status = http_parser_execute(&parser, buffer, len, request, arena);
+		if (*status == HTTP_END_OF_CONTENT) {
+			http_request_clear(request);
+			arena_rollback(arena, parser.checkpoint);
+		}
+		if (*status)
+			break;
+
+		*consumed = parser.pos;
+		count++;
+		http_parser_next(&parser);
+	}
+
+	return count;
+}
+
+uint8_t http_parse_response(const char* buffer, size_t len, Http_Response* response, uint8_t flags, Arena* arena)
+{
+	Http_Parser parser;
+	http_parser_init(&parser, flags);
+
+	// The buffer holds the whole response, so its end is where the connection closed
+	uint8_t status = http_parser_execute_response(&parser, buffer, len, response, arena);
+	if (status == HTTP_END_OF_CONTENT)
+		status = http_parser_finish(&parser);
+
+	if (status == HTTP_END_OF_CONTENT) {
+		http_response_clear(response);
+		arena_rollback(arena, parser.checkpoint);
+	}
 
-HTTP_PARSE_ERROR:
-	memset(request, 0, sizeof(Http_Request));
-	arena_rollback(arena, checkpoint);
 	return status;
 }
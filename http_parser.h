@@ -5,9 +5,28 @@
 #include "hashtable.h"
 
 #include "arena.h"
+#include "http_scan.h"
+#include "http_headers.h"
 
 #define HTTP_MAX_METHOD_LEN 8
-#define HTTP_MAX_TARGET_LEN 256
+
+#ifndef HTTP_INLINE_HEADERS
+#define HTTP_INLINE_HEADERS 8
+#endif
+
+// Limits a parser starts with, see Http_Limits
+#ifndef HTTP_DEFAULT_MAX_HEAD
+#define HTTP_DEFAULT_MAX_HEAD 0x10000			// 64 KB
+#endif
+#ifndef HTTP_DEFAULT_MAX_HEADERS
+#define HTTP_DEFAULT_MAX_HEADERS 100
+#endif
+#ifndef HTTP_DEFAULT_MAX_HEADER_SIZE
+#define HTTP_DEFAULT_MAX_HEADER_SIZE 0x2000	// 8 KB
+#endif
+#ifndef HTTP_DEFAULT_MAX_BODY
+#define HTTP_DEFAULT_MAX_BODY 0x800000			// 8 MB
+#endif
 
 #define HTTP_SUCCESS				0x00
 #define HTTP_EMPTY_TOKEN			0x01
@@ -26,34 +45,239 @@
 #define HTTP_HEADER_VALUE_EXPECTED	0x0E
 #define HTTP_INVALID_BODY_LENGTH	0x0F
 #define HTTP_OOM					0x10
+#define HTTP_INVALID_CHUNK_SIZE		0x11
+#define HTTP_INVALID_TRANSFER_ENCODING	0x12
+#define HTTP_STATUS_EXPECTED		0x13
+#define HTTP_INVALID_PERCENT_ENCODING	0x14
+#define HTTP_HEADERS_TOO_LARGE		0x15
+#define HTTP_TOO_MANY_HEADERS		0x16
+#define HTTP_HEADER_FIELD_TOO_LARGE	0x17
+#define HTTP_BODY_TOO_LARGE			0x18
+#define HTTP_UNSUPPORTED_ENCODING	0x19
+#define HTTP_INVALID_ENCODING		0x1A
+
+// Parser flags
+#define HTTP_PARSE_ZERO_COPY		0x01
+#define HTTP_PARSE_HEAD_RESPONSE	0x02	// Response to a HEAD request, never has a body
+
+typedef enum {
+	HTTP_METHOD_OTHER,
+	HTTP_METHOD_GET,
+	HTTP_METHOD_HEAD,
+	HTTP_METHOD_POST,
+	HTTP_METHOD_PUT,
+	HTTP_METHOD_DELETE,
+	HTTP_METHOD_CONNECT,
+	HTTP_METHOD_OPTIONS,
+	HTTP_METHOD_TRACE,
+	HTTP_METHOD_PATCH,
+	HTTP_METHOD_COUNT
+} Http_Method;
+
+typedef enum {
+	HTTP_TARGET_ORIGIN,		// /path?query
+	HTTP_TARGET_ABSOLUTE,	// scheme://authority/path?query, mostly sent to proxies
+	HTTP_TARGET_AUTHORITY,	// host:port, only for CONNECT
+	HTTP_TARGET_ASTERISK	// *, only for OPTIONS
+} Http_Target_Form;
 
+// Offset and length of a component within the target
 typedef struct {
-	char* name;
-	char* value;
+	uint32_t offset;
+	uint32_t len;
+} Http_Uri_Part;
+
+// Request target components, recorded while the target is validated so nothing
+// is rescanned. Offsets are relative to the target and hold in both copy and
+// zero-copy mode. Absent components have len 0; the path keeps its leading '/',
+// the query and fragment exclude their '?' and '#'.
+typedef struct {
+	Http_Target_Form form;
+	Http_Uri_Part scheme;
+	Http_Uri_Part authority;
+	Http_Uri_Part host;
+	Http_Uri_Part port;
+	Http_Uri_Part path;
+	Http_Uri_Part query;
+	Http_Uri_Part fragment;
+} Http_Uri;
+
+// View of a header returned by http_header_at. In zero-copy mode name and
+// value point into the input buffer and are not NUL terminated.
+typedef struct {
+	const char* name;
+	const char* value;
+	size_t name_len;
+	size_t value_len;
+	Http_Header_Id id;
 } Http_Header;
 
+// Position of a header relative to the start of its section
+typedef struct {
+	uint32_t name;
+	uint32_t name_len;
+	uint32_t value;
+	uint32_t value_len;
+} Http_Header_Span;
+
+// Headers are kept as offsets from base, which is the header section in the input
+// buffer in zero-copy mode and otherwise a single arena copy of it, with every
+// name and value NUL terminated in place. The first HTTP_INLINE_HEADERS are
+// stored inline and only the rest spill into the arena.
 typedef struct {
-	Http_Header* items;
+	const char* base;
 	size_t count;
 	size_t capacity;
+	Http_Header_Span spans[HTTP_INLINE_HEADERS];
+	uint8_t ids[HTTP_INLINE_HEADERS];
+	// Headers past the inline ones, capacity entries each
+	Http_Header_Span* spill_spans;
+	uint8_t* spill_ids;
 } Http_Header_Array;
 
 typedef struct 
 {
 	// Start Line
-	char method[HTTP_MAX_METHOD_LEN + 1];
-	char target[HTTP_MAX_TARGET_LEN + 1];
+	const char* method;
+	const char* target;
+	Http_Method method_id;
+	size_t method_len;
+	size_t target_len;
+	Http_Uri uri;
 	uint8_t major_version;
 	uint8_t minor_version;
 
 	//hashtable_t* headers;
 	Http_Header_Array headers;
+	// Index + 1 into headers of the first header with each known ID, 0 if absent
+	uint16_t known_headers[HTTP_HEADER_ID_COUNT];
 	uint8_t* body;
 	size_t body_len;
+
+	// Only filled for chunked bodies
+	Http_Header_Array trailers;
 } Http_Request;
 
+typedef struct 
+{
+	// Status Line
+	uint8_t major_version;
+	uint8_t minor_version;
+	uint16_t status_code;
+	const char* reason;
+	size_t reason_len;
+
+	Http_Header_Array headers;
+	// Index + 1 into headers of the first header with each known ID, 0 if absent
+	uint16_t known_headers[HTTP_HEADER_ID_COUNT];
+	uint8_t* body;
+	size_t body_len;
+
+	// Only filled for chunked bodies
+	Http_Header_Array trailers;
+} Http_Response;
+
+// Receives body data as it is parsed, e.g. each piece of a chunked upload.
+// Data points into the input buffer; with a callback set the body is not kept in the arena.
+typedef void (*Http_Body_Callback)(void* user_data, const char* data, size_t len);
+
+// Event interface for consumers that look at a few fields and keep nothing else.
+// With callbacks set the parser allocates nothing, the arena may be NULL: every
+// pointer handed out points into the input buffer, valid as long as its bytes
+// are, and the headers are passed to on_header instead of being stored. The
+// request keeps only its start line and, to frame the body, the first
+// Content-Length, Transfer-Encoding and Content-Encoding. Trailers go to
+// on_header as well. Every callback is optional; returning anything but
+// HTTP_SUCCESS stops the parse with that status.
+typedef struct {
+	uint8_t (*on_method)(void* user_data, const char* method, size_t len);
+	uint8_t (*on_target)(void* user_data, const char* target, size_t len);
+	uint8_t (*on_header)(void* user_data, const char* name, size_t name_len, const char* value, size_t value_len);
+	uint8_t (*on_headers_complete)(void* user_data);
+	uint8_t (*on_body_chunk)(void* user_data, const char* data, size_t len);
+} Http_Callbacks;
+
+// Hard limits on a single message, 0 for no limit. They are checked as the
+// bytes are scanned, so a message fails as soon as it crosses one, before it
+// is buffered or allocated for in full.
+typedef struct {
+	size_t max_head;			// Start line and headers up to the empty line: HTTP_HEADERS_TOO_LARGE
+	size_t max_headers;			// Header count, trailers counted on their own: HTTP_TOO_MANY_HEADERS
+	size_t max_header_size;		// One header line, name to CRLF: HTTP_HEADER_FIELD_TOO_LARGE
+	size_t max_body;			// Body after any chunked framing: HTTP_BODY_TOO_LARGE
+} Http_Limits;
+
+extern const Http_Limits http_default_limits;
+
+// Content-Encoding stage, see http_decode.h
+typedef struct Http_Decoder Http_Decoder;
+
+// Saved position of an in-progress parse. Feed it the same (growing) buffer
+// on every call; parsing resumes at the first byte not yet scanned.
+// With HTTP_PARSE_ZERO_COPY the buffer must also stay at the same address.
+// Once a request is complete, pos is the number of bytes it consumed.
+typedef struct {
+	// Kept between pipelined requests
+	uint8_t flags;
+	Http_Body_Callback on_body;
+	const Http_Callbacks* callbacks;	// NULL to fill in the request or response
+	void* user_data;			// Passed to on_body and the callbacks
+	const Http_Limits* limits;	// http_default_limits after init, never NULL
+	Http_Decoder* decoder;		// NULL keeps bodies as they were sent
+	size_t pos;
+
+	uint8_t stage;
+	uint8_t state;
+	uint8_t substate;
+	uint8_t count;
+	uint8_t error;
+	uint8_t body_type;
+	uint8_t header_id;
+	size_t mark;
+	size_t start;				// Where the message begins
+	size_t section;
+	size_t body_left;
+	size_t body_capacity;
+	size_t body_read;			// Body bytes as sent, which max_body counts
+	size_t fields;				// Header lines of the current section, which max_headers counts
+	size_t head_fields;			// Header lines of the head, once the trailers are being counted
+	Http_Header_Span header;
+	unsigned char* checkpoint;
+	Http_Index index;
+} Http_Parser;
+
 //http_request_t* http_parse_request(char* buffer, size_t len);
-uint8_t http_parse_request(char* buffer, size_t len, Http_Request* request, Arena* arena);
+uint8_t http_parse_request(const char* buffer, size_t len, Http_Request* request, Arena* arena);
+
+void http_parser_init(Http_Parser* parser, uint8_t flags);
+// Returns HTTP_END_OF_CONTENT while the request is incomplete; call again once more data arrives
+uint8_t http_parser_execute(Http_Parser* parser, const char* buffer, size_t len, Http_Request* request, Arena* arena);
+uint8_t http_parser_execute_response(Http_Parser* parser, const char* buffer, size_t len, Http_Response* response, Arena* arena);
+Http_Header http_header_at(const Http_Header_Array* headers, size_t index);
+// Constant time lookup of the first header with a known ID, name is NULL if absent
+Http_Header http_request_header(const Http_Request* request, Http_Header_Id id);
+Http_Header http_response_header(const Http_Response* response, Http_Header_Id id);
+// Case-insensitive map from name to the index + 1 of the first header with that name, for
+// lookups of names without an ID. Sized up front, so with an arena it is a single allocation.
+uint8_t http_header_map(const Http_Header_Array* headers, hashtable_t* map, Arena* arena);
+// Signals the connection was closed, which completes a response whose body runs until close
+uint8_t http_parser_finish(Http_Parser* parser);
+// Prepares the parser for the next pipelined request in the same buffer, starting where the last one ended
+void http_parser_next(Http_Parser* parser);
+// Readies a parsed or failed request and its arena for the next request on the same connection.
+// Only what the last request wrote is cleared, the arena keeps its blocks and the header spill
+// keeps its capacity, so a keep-alive connection settles into parsing without allocating.
+void http_request_reset(Http_Request* request, Arena* arena);
+
+// Parses consecutive complete requests into requests[0..max), all sharing the arena, and returns how many were parsed.
+// *consumed is the offset right after the last of them, where a trailing partial (HTTP_END_OF_CONTENT) or invalid request starts.
+size_t http_parse_requests(const char* buffer, size_t len, Http_Request* requests, size_t max, uint8_t flags, size_t* consumed, uint8_t* status, Arena* arena);
+uint8_t http_parse_response(const char* buffer, size_t len, Http_Response* response, uint8_t flags, Arena* arena);
+// Case-sensitive, as methods are; HTTP_METHOD_OTHER for extension methods
+Http_Method http_method_id(const char* method, size_t len);
+const char* http_method_name(Http_Method method);
+// Pointer to a component of the request target, e.g. http_uri_part(request, request->uri.query)
+const char* http_uri_part(const Http_Request* request, Http_Uri_Part part);
 void http_get_error_str(uint8_t error, char* buffer, size_t len);
 
 #endif
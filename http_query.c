@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "http_query.h"
+#include "http_scan.h"
+
+static int8_t http_query_hex_value(const char c)
+{
+	if ('0' <= c && c <= '9')
+		return c - '0';
+	if ('a' <= (c | 0x20) && (c | 0x20) <= 'f')
+		return (c | 0x20) - 'a' + 10;
+	return -1;
+}
+
+void http_query_init(Http_Query_Iter* iter, const char* query, size_t len)
+{
+	iter->it = query;
+	iter->end = query + len;
+}
+
+uint8_t http_query_next(Http_Query_Iter* iter, Http_Query_Param* param)
+{
+	while (iter->it < iter->end) {
+		const char* pair = iter->it;
+		const char* pair_end = memchr(pair, '&', iter->end - pair);
+		if (pair_end == NULL)
+			pair_end = iter->end;
+		iter->it = pair_end < iter->end ? pair_end + 1 : pair_end;
+
+		if (pair_end == pair)
+			continue;
+
+		const char* equals = memchr(pair, '=', pair_end - pair);
+		param->name = pair;
+		if (equals == NULL) {
+			param->name_len = pair_end - pair;
+			param->value = pair_end;
+			param->value_len = 0;
+		}
+		else {
+			param->name_len = equals - pair;
+			param->value = equals + 1;
+			param->value_len = pair_end - equals - 1;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+// Runs between escapes are found by the vector scan and moved in bulk
+uint8_t http_query_decode(const char* in, size_t len, char* out, size_t* out_len)
+{
+	const char* it = in;
+	const char* end = in + len;
+	char* dst = out;
+
+	while (it < end) {
+		const char* run = http_scan_plain(it, end);
+		if (dst != it)
+			memmove(dst, it, run - it);
+		dst += run - it;
+		if (run == end)
+			break;
+
+		if (*run == '+') {
+			*dst++ = ' ';
+			it = run + 1;
+			continue;
+		}
+
+		if (end - run < 3)
+			return HTTP_INVALID_PERCENT_ENCODING;
+		int8_t high = http_query_hex_value(run[1]);
+		int8_t low = http_query_hex_value(run[2]);
+		if (high < 0 || low < 0)
+			return HTTP_INVALID_PERCENT_ENCODING;
+
+		*dst++ = (char)(high << 4 | low);
+		it = run + 3;
+	}
+
+	*out_len = dst - out;
+	return HTTP_SUCCESS;
+}
+
+uint8_t http_query_decode_alloc(const char* in, size_t len, const char** out, size_t* out_len, Arena* arena)
+{
+	const char* first = http_scan_plain(in, in + len);
+	if (first == in + len) {
+		*out = in;
+		*out_len = len;
+		return HTTP_SUCCESS;
+	}
+
+	unsigned char* checkpoint = arena_checkpoint(arena);
+	char* copy = arena_alloc(arena, len + 1);
+	if (copy == NULL)
+		return HTTP_OOM;
+
+	size_t plain = first - in;
+	memcpy(copy, in, plain);
+
+	size_t decoded;
+	uint8_t status = http_query_decode(first, len - plain, copy + plain, &decoded);
+	if (status) {
+		// Nothing of a failed decode is kept
+		arena_rollback(arena, checkpoint);
+		return status;
+	}
+
+	copy[plain + decoded] = '\0';
+	*out = copy;
+	*out_len = plain + decoded;
+	return HTTP_SUCCESS;
+}
@@ -0,0 +1,37 @@
+#ifndef HTTP_QUERY_H
+#define HTTP_QUERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "http_parser.h"
+
+// Walks the name=value pairs of a query string without allocating, e.g.
+// http_query_init(&iter, http_uri_part(request, request->uri.query), request->uri.query.len).
+// Pairs are handed out still encoded, decode only the ones that are needed.
+typedef struct {
+	const char* it;
+	const char* end;
+} Http_Query_Iter;
+
+// Name and value point into the query; a pair without '=' has an empty value
+typedef struct {
+	const char* name;
+	const char* value;
+	size_t name_len;
+	size_t value_len;
+} Http_Query_Param;
+
+void http_query_init(Http_Query_Iter* iter, const char* query, size_t len);
+// Returns 0 once there are no pairs left; empty pairs ("a=1&&b=2") are skipped
+uint8_t http_query_next(Http_Query_Iter* iter, Http_Query_Param* param);
+
+// Decodes percent-escapes and '+' into out, which needs room for len bytes and
+// may be the input itself since decoding never grows the text
+uint8_t http_query_decode(const char* in, size_t len, char* out, size_t* out_len);
+// Same, but returns the input itself when there is nothing to decode and
+// otherwise a NUL terminated copy in the arena
+uint8_t http_query_decode_alloc(const char* in, size_t len, const char** out, size_t* out_len, Arena* arena);
+
+#endif
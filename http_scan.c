@@ -0,0 +1,376 @@
+#include <string.h>
+
+#include "http_scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HTTP_SCAN_X86
+#include <immintrin.h>
+#endif
+
+const uint8_t http_char_class[256] = 
+{
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x30, 0x23, 0x20, 0x21, 0x23, 0x23, 0x23, 0x23, 0x22, 0x22, 0x23, 0x23, 0x22, 0x23, 0x23, 0x22,
+	0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x22, 0x22, 0x20, 0x22, 0x20, 0x20,
+	0x22, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B,
+	0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x22, 0x20, 0x22, 0x21, 0x23,
+	0x21, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B,
+	0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x20, 0x21, 0x20, 0x23, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const char* http_scan_class(const char* it, const char* end, uint8_t class)
+{
+	while (it < end && (http_char_class[(unsigned char)*it] & class)) ++it;
+	return it;
+}
+
+static const char* http_scan_tchar_scalar(const char* it, const char* end)
+{
+	return http_scan_class(it, end, HTTP_CHAR_TCHAR);
+}
+
+static const char* http_scan_uri_scalar(const char* it, const char* end)
+{
+	return http_scan_class(it, end, HTTP_CHAR_URI);
+}
+
+static const char* http_scan_vchar_scalar(const char* it, const char* end)
+{
+	return http_scan_class(it, end, HTTP_CHAR_VCHAR);
+}
+
+static const char* http_scan_plain_scalar(const char* it, const char* end)
+{
+	while (it < end && *it != '%' && *it != '+') ++it;
+	return it;
+}
+
+#ifdef HTTP_SCAN_X86
+
+// The vector kernels compute a mask of the bytes OUTSIDE the class and stop
+// at its first set bit. Unsigned byte compares are done with min/max since
+// SSE2 and AVX2 only have signed greater-than.
+
+#define HTTP_SSE2_LE(v, x) _mm_cmpeq_epi8(_mm_min_epu8((v), _mm_set1_epi8(x)), (v))
+#define HTTP_SSE2_GE(v, x) _mm_cmpeq_epi8(_mm_max_epu8((v), _mm_set1_epi8(x)), (v))
+#define HTTP_SSE2_EQ(v, x) _mm_cmpeq_epi8((v), _mm_set1_epi8(x))
+#define HTTP_SSE2_RANGE(v, lo, hi) _mm_and_si128(HTTP_SSE2_GE(v, lo), HTTP_SSE2_LE(v, hi))
+
+#define HTTP_AVX2_LE(v, x) _mm256_cmpeq_epi8(_mm256_min_epu8((v), _mm256_set1_epi8(x)), (v))
+#define HTTP_AVX2_GE(v, x) _mm256_cmpeq_epi8(_mm256_max_epu8((v), _mm256_set1_epi8(x)), (v))
+#define HTTP_AVX2_EQ(v, x) _mm256_cmpeq_epi8((v), _mm256_set1_epi8(x))
+#define HTTP_AVX2_RANGE(v, lo, hi) _mm256_and_si256(HTTP_AVX2_GE(v, lo), HTTP_AVX2_LE(v, hi))
+
+static inline __m128i http_sse2_not_tchar(__m128i v)
+{
+	__m128i bad = _mm_or_si128(HTTP_SSE2_LE(v, 0x20), HTTP_SSE2_GE(v, 0x7F));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '"'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_RANGE(v, '(', ')'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, ','));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '/'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_RANGE(v, ':', '@'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_RANGE(v, '[', ']'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '{'));
+	return _mm_or_si128(bad, HTTP_SSE2_EQ(v, '}'));
+}
+
+static inline __m128i http_sse2_not_uri(__m128i v)
+{
+	__m128i bad = _mm_or_si128(HTTP_SSE2_LE(v, 0x20), HTTP_SSE2_GE(v, 0x7F));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '"'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '#'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '?'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '<'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '>'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '\\'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '^'));
+	bad = _mm_or_si128(bad, HTTP_SSE2_EQ(v, '`'));
+	return _mm_or_si128(bad, HTTP_SSE2_RANGE(v, '{', '}'));
+}
+
+static inline __m128i http_sse2_not_vchar(__m128i v)
+{
+	__m128i ctl = _mm_andnot_si128(HTTP_SSE2_EQ(v, '\t'), HTTP_SSE2_LE(v, 0x1F));
+	return _mm_or_si128(ctl, HTTP_SSE2_GE(v, 0x7F));
+}
+
+static inline __m128i http_sse2_not_plain(__m128i v)
+{
+	return _mm_or_si128(HTTP_SSE2_EQ(v, '%'), HTTP_SSE2_EQ(v, '+'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i http_avx2_not_tchar(__m256i v)
+{
+	__m256i bad = _mm256_or_si256(HTTP_AVX2_LE(v, 0x20), HTTP_AVX2_GE(v, 0x7F));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '"'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_RANGE(v, '(', ')'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, ','));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '/'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_RANGE(v, ':', '@'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_RANGE(v, '[', ']'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '{'));
+	return _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '}'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i http_avx2_not_uri(__m256i v)
+{
+	__m256i bad = _mm256_or_si256(HTTP_AVX2_LE(v, 0x20), HTTP_AVX2_GE(v, 0x7F));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '"'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '#'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '?'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '<'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '>'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '\\'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '^'));
+	bad = _mm256_or_si256(bad, HTTP_AVX2_EQ(v, '`'));
+	return _mm256_or_si256(bad, HTTP_AVX2_RANGE(v, '{', '}'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i http_avx2_not_vchar(__m256i v)
+{
+	__m256i ctl = _mm256_andnot_si256(HTTP_AVX2_EQ(v, '\t'), HTTP_AVX2_LE(v, 0x1F));
+	return _mm256_or_si256(ctl, HTTP_AVX2_GE(v, 0x7F));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i http_avx2_not_plain(__m256i v)
+{
+	return _mm256_or_si256(HTTP_AVX2_EQ(v, '%'), HTTP_AVX2_EQ(v, '+'));
+}
+
+#define HTTP_SSE2_KERNEL(name, classifier, tail) \
+	static const char* name(const char* it, const char* end) \
+	{ \
+		while (end - it >= 16) { \
+			__m128i v = _mm_loadu_si128((const __m128i*)it); \
+			unsigned mask = _mm_movemask_epi8(classifier(v)); \
+			if (mask) \
+				return it + __builtin_ctz(mask); \
+			it += 16; \
+		} \
+		return tail(it, end); \
+	}
+
+#define HTTP_AVX2_KERNEL(name, classifier, tail) \
+	__attribute__((target("avx2"))) \
+	static const char* name(const char* it, const char* end) \
+	{ \
+		while (end - it >= 32) { \
+			__m256i v = _mm256_loadu_si256((const __m256i*)it); \
+			unsigned mask = _mm256_movemask_epi8(classifier(v)); \
+			if (mask) \
+				return it + __builtin_ctz(mask); \
+			it += 32; \
+		} \
+		return tail(it, end); \
+	}
+
+HTTP_SSE2_KERNEL(http_scan_tchar_sse2, http_sse2_not_tchar, http_scan_tchar_scalar)
+HTTP_SSE2_KERNEL(http_scan_uri_sse2, http_sse2_not_uri, http_scan_uri_scalar)
+HTTP_SSE2_KERNEL(http_scan_vchar_sse2, http_sse2_not_vchar, http_scan_vchar_scalar)
+HTTP_SSE2_KERNEL(http_scan_plain_sse2, http_sse2_not_plain, http_scan_plain_scalar)
+
+HTTP_AVX2_KERNEL(http_scan_tchar_avx2, http_avx2_not_tchar, http_scan_tchar_scalar)
+HTTP_AVX2_KERNEL(http_scan_uri_avx2, http_avx2_not_uri, http_scan_uri_scalar)
+HTTP_AVX2_KERNEL(http_scan_vchar_avx2, http_avx2_not_vchar, http_scan_vchar_scalar)
+HTTP_AVX2_KERNEL(http_scan_plain_avx2, http_avx2_not_plain, http_scan_plain_scalar)
+
+static void http_index_block_sse2(const char* block, uint64_t* not_tchar, uint64_t* not_uri, uint64_t* not_vchar)
+{
+	*not_tchar = *not_uri = *not_vchar = 0;
+	for (int i = 0; i < 64; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(block + i));
+		*not_tchar |= (uint64_t)(uint16_t)_mm_movemask_epi8(http_sse2_not_tchar(v)) << i;
+		*not_uri |= (uint64_t)(uint16_t)_mm_movemask_epi8(http_sse2_not_uri(v)) << i;
+		*not_vchar |= (uint64_t)(uint16_t)_mm_movemask_epi8(http_sse2_not_vchar(v)) << i;
+	}
+}
+
+__attribute__((target("avx2")))
+static void http_index_block_avx2(const char* block, uint64_t* not_tchar, uint64_t* not_uri, uint64_t* not_vchar)
+{
+	__m256i lo = _mm256_loadu_si256((const __m256i*)block);
+	__m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+	*not_tchar = (uint32_t)_mm256_movemask_epi8(http_avx2_not_tchar(lo)) | (uint64_t)(uint32_t)_mm256_movemask_epi8(http_avx2_not_tchar(hi)) << 32;
+	*not_uri = (uint32_t)_mm256_movemask_epi8(http_avx2_not_uri(lo)) | (uint64_t)(uint32_t)_mm256_movemask_epi8(http_avx2_not_uri(hi)) << 32;
+	*not_vchar = (uint32_t)_mm256_movemask_epi8(http_avx2_not_vchar(lo)) | (uint64_t)(uint32_t)_mm256_movemask_epi8(http_avx2_not_vchar(hi)) << 32;
+}
+
+#endif
+
+typedef struct {
+	uint8_t level;
+	const char* (*tchar)(const char* it, const char* end);
+	const char* (*uri)(const char* it, const char* end);
+	const char* (*vchar)(const char* it, const char* end);
+	const char* (*plain)(const char* it, const char* end);
+	// NULL where a table lookup per byte would cost as much as the scans it saves
+	void (*index)(const char* block, uint64_t* not_tchar, uint64_t* not_uri, uint64_t* not_vchar);
+} Http_Scan_Kernels;
+
+static const Http_Scan_Kernels kernels[] = 
+{
+	{ HTTP_SCAN_SCALAR, http_scan_tchar_scalar, http_scan_uri_scalar, http_scan_vchar_scalar, http_scan_plain_scalar, NULL },
+#ifdef HTTP_SCAN_X86
+	{ HTTP_SCAN_SSE2, http_scan_tchar_sse2, http_scan_uri_sse2, http_scan_vchar_sse2, http_scan_plain_sse2, http_index_block_sse2 },
+	{ HTTP_SCAN_AVX2, http_scan_tchar_avx2, http_scan_uri_avx2, http_scan_vchar_avx2, http_scan_plain_avx2, http_index_block_avx2 },
+#endif
+};
+
+// Never NULL, so no call has to check. Without a constructor to pick the best
+// level, the scalar kernels are all there are anyway.
+static const Http_Scan_Kernels* active_kernels = &kernels[HTTP_SCAN_SCALAR];
+
+static uint8_t http_scan_is_supported(uint8_t level)
+{
+#ifdef HTTP_SCAN_X86
+	if (level == HTTP_SCAN_AVX2)
+		return __builtin_cpu_supports("avx2") != 0;
+	if (level == HTTP_SCAN_SSE2)
+		return __builtin_cpu_supports("sse2") != 0;
+#endif
+	return level == HTTP_SCAN_SCALAR;
+}
+
+uint8_t http_scan_set_level(uint8_t level)
+{
+	size_t count = sizeof(kernels) / sizeof(kernels[0]);
+	if (level >= count)
+		level = count - 1;
+
+	while (level > HTTP_SCAN_SCALAR && !http_scan_is_supported(level))
+		level--;
+
+	active_kernels = &kernels[level];
+	return level;
+}
+
+#ifdef __GNUC__
+// Resolved once before main, so threads never race to pick the kernels on first use
+__attribute__((constructor))
+static void http_scan_init(void)
+{
+#ifdef HTTP_SCAN_X86
+	// Constructors may run before the CPU model is, it has to be set up first
+	__builtin_cpu_init();
+#endif
+	http_scan_set_level(HTTP_SCAN_AVX2);
+}
+#endif
+
+uint8_t http_scan_get_level(void)
+{
+	return active_kernels->level;
+}
+
+const char* http_scan_tchar(const char* it, const char* end)
+{
+	return active_kernels->tchar(it, end);
+}
+
+const char* http_scan_uri(const char* it, const char* end)
+{
+	return active_kernels->uri(it, end);
+}
+
+const char* http_scan_vchar(const char* it, const char* end)
+{
+	return active_kernels->vchar(it, end);
+}
+
+const char* http_scan_plain(const char* it, const char* end)
+{
+	return active_kernels->plain(it, end);
+}
+
+// Whether the head ends in the block, the first CRLFCRLF at or after start ending in it. Four
+// bytes in a row outside VCHAR are rare in a head, so few places are actually compared.
+static uint8_t http_index_has_head_end(const Http_Index* index, const char* buffer, size_t block, size_t start)
+{
+	size_t base = block * 64;
+	for (size_t pos = base >= 3 ? base - 3 : 0; pos < base; ++pos) {
+		if (pos >= start && memcmp(buffer + pos, "\r\n\r\n", 4) == 0)
+			return 1;
+	}
+
+	uint64_t bits = index->not_vchar[block];
+	uint64_t runs = bits & (bits >> 1) & (bits >> 2) & (bits >> 3);
+	while (runs) {
+		size_t pos = base + __builtin_ctzll(runs);
+		if (pos >= start && memcmp(buffer + pos, "\r\n\r\n", 4) == 0)
+			return 1;
+		runs &= runs - 1;
+	}
+	return 0;
+}
+
+void http_index_update(Http_Index* index, const char* buffer, size_t start, size_t len)
+{
+	if (index->complete || active_kernels->index == NULL)
+		return;
+
+	size_t blocks = len / 64;
+	if (blocks > HTTP_INDEX_BLOCKS)
+		blocks = HTTP_INDEX_BLOCKS;
+
+	size_t i = index->blocks > start / 64 ? index->blocks : start / 64;
+	for (; i < blocks; ++i) {
+		active_kernels->index(buffer + i * 64, &index->not_tchar[i], &index->not_uri[i], &index->not_vchar[i]);
+		if (http_index_has_head_end(index, buffer, i, start)) {
+			index->complete = 1;
+			i++;
+			break;
+		}
+	}
+
+	if (i > index->blocks)
+		index->blocks = i;
+}
+
+size_t http_index_scan(const Http_Index* index, const char* buffer, size_t pos, size_t len, uint8_t class)
+{
+	const uint64_t* map = index->not_vchar;
+	const char* (*scan)(const char* it, const char* end) = http_scan_vchar;
+	if (class == HTTP_CHAR_TCHAR) {
+		map = index->not_tchar;
+		scan = http_scan_tchar;
+	}
+	else if (class == HTTP_CHAR_URI) {
+		map = index->not_uri;
+		scan = http_scan_uri;
+	}
+
+	if (pos >= len)
+		return len;
+
+	// The bitmaps run past len when a limit ends the range early, a bit there is no answer
+	size_t block = pos / 64;
+	if (block < index->blocks) {
+		uint64_t bits = map[block] & (~(uint64_t)0 << (pos % 64));
+		while (!bits && ++block < index->blocks && block * 64 < len)
+			bits = map[block];
+
+		if (bits) {
+			size_t found = block * 64 + __builtin_ctzll(bits);
+			return found < len ? found : len;
+		}
+
+		pos = index->blocks * 64;
+		if (pos >= len)
+			return len;
+	}
+
+	return scan(buffer + pos, buffer + len) - buffer;
+}
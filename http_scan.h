@@ -0,0 +1,61 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Character classes, one bit per class in http_char_class
+#define HTTP_CHAR_TCHAR			0x01
+#define HTTP_CHAR_URI			0x02	// Except the '?' and '#' delimiters, so scans stop at the query and fragment
+#define HTTP_CHAR_DIGIT			0x04
+#define HTTP_CHAR_ALPHA			0x08
+#define HTTP_CHAR_WHITESPACE	0x10
+#define HTTP_CHAR_VCHAR			0x20
+
+// Scan kernel implementations, selected at runtime by CPU support
+#define HTTP_SCAN_SCALAR		0x00
+#define HTTP_SCAN_SSE2			0x01
+#define HTTP_SCAN_AVX2			0x02
+
+#ifndef HTTP_INDEX_BLOCKS
+#define HTTP_INDEX_BLOCKS		64
+#endif
+
+extern const uint8_t http_char_class[256];
+
+// Structural index over the head of a message within the first HTTP_INDEX_BLOCKS * 64
+// bytes of the buffer. Each map has one bit per byte marking where a run of that class
+// ends, so every CR, LF, colon and space is recorded along with any invalid byte.
+// Blocks are numbered from the start of the buffer; those before the block the message
+// starts in may be left over from an earlier message, which is never scanned again.
+typedef struct {
+	uint64_t not_tchar[HTTP_INDEX_BLOCKS];
+	uint64_t not_uri[HTTP_INDEX_BLOCKS];
+	uint64_t not_vchar[HTTP_INDEX_BLOCKS];
+	size_t blocks;
+	uint8_t complete;			// The block holding the end of the head is indexed
+} Http_Index;
+
+// Each scan returns a pointer to the first byte in [it, end) outside the class, or end
+const char* http_scan_tchar(const char* it, const char* end);
+const char* http_scan_uri(const char* it, const char* end);
+const char* http_scan_vchar(const char* it, const char* end);
+// Returns the first '%' or '+' in [it, end), or end: the bytes before it decode to themselves
+const char* http_scan_plain(const char* it, const char* end);
+
+// Indexes the complete 64-byte blocks of [buffer, buffer + len) not indexed yet, from the block
+// of the message starting at start up to the first CRLFCRLF after it, so bodies and the messages
+// after it are left alone. Pass len no further than the head may reach. The scalar level
+// builds no index, its scans are as quick as the index would be to read.
+void http_index_update(Http_Index* index, const char* buffer, size_t start, size_t len);
+// Returns the offset of the first byte at or after pos outside the class (TCHAR, URI or VCHAR),
+// or len if there is none before it, read from the index and falling back to the scan kernels
+// past the indexed blocks
+size_t http_index_scan(const Http_Index* index, const char* buffer, size_t pos, size_t len, uint8_t class);
+
+// Returns the kernel level in use; http_scan_set_level falls back to the best supported level below the one requested.
+// The best level is picked before main, change it only while no other thread is parsing.
+uint8_t http_scan_get_level(void);
+uint8_t http_scan_set_level(uint8_t level);
+
+#endif
@@ -0,0 +1,1166 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#ifdef HTTP_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "http_server.h"
+#include "arena.h"
+
+#define HTTP_SERVER_BUFFER_SIZE 0x1000
+#define HTTP_SERVER_MAX_BUFFER 0x800000		// Largest request (head and body) a connection buffers
+#define HTTP_SERVER_MAX_EVENTS 256
+
+#ifdef HTTP_HAVE_IO_URING
+#define HTTP_URING_ENTRIES 1024			// Submission queue, the completion queue gets four times as many
+#define HTTP_URING_RECV_BUFFERS 512		// Provided receive buffers per loop, a power of two
+#define HTTP_URING_SEND_BUFFERS 256		// Registered send buffers per loop
+
+// Completions carry the connection pointer with the operation in its low bits.
+// The listener and wake completions carry pointers to the loop's fds instead.
+#define HTTP_URING_RECV 1
+#define HTTP_URING_SEND 2
+#define HTTP_URING_OP_MASK 3
+
+typedef struct {
+	int fd;
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_pending;		// Local tail, published on submit
+	unsigned sq_submitted;
+	struct io_uring_sqe* sqes;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe* cqes;
+	void* ring_map;
+	size_t ring_map_len;
+	void* sqe_map;
+	size_t sqe_map_len;
+
+	// Provided buffer ring the kernel picks receive buffers from
+	struct io_uring_buf_ring* buf_ring;
+	char* recv_buffers;
+	uint16_t buf_tail;
+
+	// Registered fixed buffers responses are built in, NULL if registration failed
+	char* send_buffers;
+	uint16_t send_free[HTTP_URING_SEND_BUFFERS];
+	uint16_t send_free_count;
+} Http_Uring;
+#endif
+
+typedef struct {
+	Http_Server* server;
+	pthread_t thread;
+	int index;
+	int epoll_fd;
+	int listen_fd;
+	int wake_fd;
+	Http_Connection* connections;
+	Http_Stats stats;			// The thread's parser stats, handed over when it exits
+#ifdef HTTP_HAVE_IO_URING
+	Http_Uring ring;
+	int closing;				// Connections waiting for their last completion
+	uint8_t stopping;
+#endif
+} Http_Server_Loop;
+
+struct Http_Server {
+	Http_Server_Config config;
+	Http_Server_Backend backend;
+	Http_Server_Loop* loops;
+	int loop_count;
+	uint8_t running;
+};
+
+struct Http_Connection {
+	int fd;
+	Http_Server_Loop* loop;
+	Http_Connection* prev;
+	Http_Connection* next;
+
+	char* input;
+	size_t input_len;
+	size_t input_capacity;
+	char* output;
+	size_t output_len;
+	size_t output_sent;
+	size_t output_capacity;
+
+	Http_Parser parser;
+	Http_Request request;
+	Arena arena;
+	uint8_t close;
+#ifdef HTTP_HAVE_IO_URING
+	uint8_t output_fixed;		// Output lives in one of the loop's registered send buffers
+	uint8_t recv_active;
+	uint8_t send_active;
+	uint8_t closing;
+	int32_t send_result;
+#endif
+};
+
+static const char http_bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char http_too_large[] = "HTTP/1.1 413 Content Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char http_headers_too_large[] = "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+// Comma separated, case-insensitive token search as used by Connection
+static uint8_t http_has_token(const char* value, size_t len, const char* token)
+{
+	size_t token_len = strlen(token);
+	size_t i = 0;
+	while (i < len) {
+		while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ','))
+			i++;
+		size_t start = i;
+		while (i < len && value[i] != ',')
+			i++;
+		size_t end = i;
+		while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\t'))
+			end--;
+		if (end - start == token_len && !strncasecmp(value + start, token, token_len))
+			return 1;
+	}
+	return 0;
+}
+
+static uint8_t http_keep_alive(const Http_Request* request)
+{
+	Http_Header connection = http_request_header(request, HTTP_HEADER_CONNECTION);
+	if (request->major_version == 1 && request->minor_version >= 1)
+		return !connection.name || !http_has_token(connection.value, connection.value_len, "close");
+	return connection.name && http_has_token(connection.value, connection.value_len, "keep-alive");
+}
+
+#ifdef HTTP_HAVE_IO_URING
+static char* http_uring_send_acquire(Http_Uring* ring)
+{
+	if (ring->send_buffers == NULL || ring->send_free_count == 0)
+		return NULL;
+	return ring->send_buffers + (size_t)ring->send_free[--ring->send_free_count] * HTTP_SERVER_BUFFER_SIZE;
+}
+
+static void http_uring_send_release(Http_Uring* ring, char* buffer)
+{
+	ring->send_free[ring->send_free_count++] = (buffer - ring->send_buffers) / HTTP_SERVER_BUFFER_SIZE;
+}
+#endif
+
+static void http_connection_unlink(Http_Connection* conn)
+{
+	Http_Server_Loop* loop = conn->loop;
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		loop->connections = conn->next;
+	if (conn->next)
+		conn->next->prev = conn->prev;
+}
+
+static void http_connection_free(Http_Connection* conn)
+{
+	close(conn->fd);
+	free(conn->input);
+#ifdef HTTP_HAVE_IO_URING
+	if (conn->output_fixed)
+		http_uring_send_release(&conn->loop->ring, conn->output);
+	else
+		free(conn->output);
+#else
+	free(conn->output);
+#endif
+	arena_pool_return(arena_pool_thread(), &conn->arena, ARENA_POOL_CONNECTION);
+	free(conn);
+}
+
+static void http_connection_destroy(Http_Connection* conn)
+{
+	http_connection_unlink(conn);
+	http_connection_free(conn);
+}
+
+// Grows the output to hold at least capacity bytes. Under io_uring a response
+// that fits is built straight in one of the loop's registered send buffers and
+// moves to the heap only if it outgrows it.
+static uint8_t http_connection_reserve(Http_Connection* conn, size_t capacity)
+{
+#ifdef HTTP_HAVE_IO_URING
+	if (conn->output == NULL && capacity <= HTTP_SERVER_BUFFER_SIZE) {
+		char* buffer = http_uring_send_acquire(&conn->loop->ring);
+		if (buffer) {
+			conn->output = buffer;
+			conn->output_capacity = HTTP_SERVER_BUFFER_SIZE;
+			conn->output_fixed = 1;
+			return HTTP_SUCCESS;
+		}
+	}
+#endif
+
+	size_t size = conn->output_capacity ? conn->output_capacity : HTTP_SERVER_BUFFER_SIZE;
+	while (size < capacity)
+		size *= 2;
+
+#ifdef HTTP_HAVE_IO_URING
+	if (conn->output_fixed) {
+		char* output = malloc(size);
+		if (output == NULL)
+			return HTTP_OOM;
+		memcpy(output, conn->output, conn->output_len);
+		http_uring_send_release(&conn->loop->ring, conn->output);
+		conn->output = output;
+		conn->output_capacity = size;
+		conn->output_fixed = 0;
+		return HTTP_SUCCESS;
+	}
+#endif
+
+	char* output = realloc(conn->output, size);
+	if (output == NULL)
+		return HTTP_OOM;
+	conn->output = output;
+	conn->output_capacity = size;
+	return HTTP_SUCCESS;
+}
+
+uint8_t http_connection_write(Http_Connection* conn, const char* data, size_t len)
+{
+	if (conn->output_len + len > conn->output_capacity && http_connection_reserve(conn, conn->output_len + len))
+		return HTTP_OOM;
+
+	memcpy(conn->output + conn->output_len, data, len);
+	conn->output_len += len;
+	return HTTP_SUCCESS;
+}
+
+// Copies the pieces after skip bytes into the output
+static uint8_t http_connection_gather(Http_Connection* conn, const struct iovec* iov, int count, size_t skip)
+{
+	size_t len = 0;
+	for (int i = 0; i < count; ++i)
+		len += iov[i].iov_len;
+	len -= skip;
+	if (conn->output_len + len > conn->output_capacity && http_connection_reserve(conn, conn->output_len + len))
+		return HTTP_OOM;
+
+	for (int i = 0; i < count; ++i) {
+		size_t piece = iov[i].iov_len;
+		if (skip >= piece) {
+			skip -= piece;
+			continue;
+		}
+		memcpy(conn->output + conn->output_len, (const char*)iov[i].iov_base + skip, piece - skip);
+		conn->output_len += piece - skip;
+		skip = 0;
+	}
+	return HTTP_SUCCESS;
+}
+
+// Sends what the socket takes without blocking: the bytes sent, or -1 if the connection failed
+static ssize_t http_connection_send(Http_Connection* conn, const struct iovec* iov, int count)
+{
+	struct msghdr msg = { .msg_iov = (struct iovec*)iov, .msg_iovlen = count };
+	while (1) {
+		ssize_t sent = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+		if (sent >= 0)
+			return sent;
+		if (errno == EINTR)
+			continue;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		return -1;
+	}
+}
+
+// Nothing more reaches the peer, so the output is dropped and the flush after the handler closes the connection
+static uint8_t http_connection_drop(Http_Connection* conn)
+{
+	conn->output_len = conn->output_sent = 0;
+	conn->close = 1;
+	return HTTP_SUCCESS;
+}
+
+uint8_t http_connection_writev(Http_Connection* conn, const struct iovec* iov, int count)
+{
+#ifdef HTTP_HAVE_IO_URING
+	// Sends are queued from the output, at best from a registered buffer
+	if (conn->loop->server->backend == HTTP_SERVER_IO_URING)
+		return http_connection_gather(conn, iov, count, 0);
+#endif
+	if (count > IOV_MAX)
+		return http_connection_gather(conn, iov, count, 0);
+
+	// Under epoll the pieces go straight to the socket once the output before them
+	// is out, and only what it does not take is copied, for EPOLLOUT to finish
+	if (conn->output_sent < conn->output_len) {
+		struct iovec pending = { conn->output + conn->output_sent, conn->output_len - conn->output_sent };
+		ssize_t sent = http_connection_send(conn, &pending, 1);
+		if (sent < 0)
+			return http_connection_drop(conn);
+		conn->output_sent += sent;
+		if (conn->output_sent < conn->output_len)
+			return http_connection_gather(conn, iov, count, 0);
+		conn->output_len = conn->output_sent = 0;
+	}
+
+	ssize_t sent = http_connection_send(conn, iov, count);
+	if (sent < 0)
+		return http_connection_drop(conn);
+	return http_connection_gather(conn, iov, count, sent);
+}
+
+void http_connection_close(Http_Connection* conn)
+{
+	conn->close = 1;
+}
+
+Arena* http_connection_arena(Http_Connection* conn)
+{
+	return &conn->arena;
+}
+
+// Returns 1 if the connection was destroyed
+static uint8_t http_connection_flush(Http_Connection* conn)
+{
+	while (conn->output_sent < conn->output_len) {
+		ssize_t sent = send(conn->fd, conn->output + conn->output_sent, conn->output_len - conn->output_sent, MSG_NOSIGNAL);
+		if (sent > 0) {
+			conn->output_sent += sent;
+			continue;
+		}
+		if (sent < 0 && errno == EINTR)
+			continue;
+		// The socket is registered for EPOLLOUT, flushing resumes once it drains
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+
+		http_connection_destroy(conn);
+		return 1;
+	}
+
+	conn->output_len = conn->output_sent = 0;
+	if (conn->close) {
+		http_connection_destroy(conn);
+		return 1;
+	}
+	return 0;
+}
+
+// Readies the parser for the next request
+static void http_connection_reset(Http_Connection* conn)
+{
+	http_parser_init(&conn->parser, 0);
+	if (conn->loop->server->config.limits)
+		conn->parser.limits = conn->loop->server->config.limits;
+}
+
+// Parses and handles every complete request in data and returns the number of
+// bytes consumed. The parser restarts at each request, so what is left over is
+// an incomplete request the parser has already seen.
+static size_t http_connection_parse(Http_Connection* conn, const char* data, size_t len)
+{
+	Http_Server* server = conn->loop->server;
+	size_t consumed = 0;
+	while (consumed < len && !conn->close) {
+		uint8_t status = http_parser_execute(&conn->parser, data + consumed, len - consumed, &conn->request, &conn->arena);
+		if (status == HTTP_END_OF_CONTENT)
+			break;
+
+		if (status) {
+			if (status == HTTP_BODY_TOO_LARGE)
+				http_connection_write(conn, http_too_large, sizeof(http_too_large) - 1);
+			else if (status == HTTP_HEADERS_TOO_LARGE || status == HTTP_TOO_MANY_HEADERS || status == HTTP_HEADER_FIELD_TOO_LARGE)
+				http_connection_write(conn, http_headers_too_large, sizeof(http_headers_too_large) - 1);
+			else
+				http_connection_write(conn, http_bad_request, sizeof(http_bad_request) - 1);
+			conn->close = 1;
+			break;
+		}
+
+		if (!http_keep_alive(&conn->request))
+			conn->close = 1;
+		server->config.handler(conn, &conn->request, server->config.user_data);
+
+		consumed += conn->parser.pos;
+		http_connection_reset(conn);
+		http_request_reset(&conn->request, &conn->arena);
+	}
+	return consumed;
+}
+
+// Handles the buffered input; the incomplete request left is moved to the front
+static void http_connection_consume(Http_Connection* conn)
+{
+	size_t consumed = http_connection_parse(conn, conn->input, conn->input_len);
+	memmove(conn->input, conn->input + consumed, conn->input_len - consumed);
+	conn->input_len -= consumed;
+}
+
+static uint8_t http_connection_process(Http_Connection* conn)
+{
+	http_connection_consume(conn);
+	return http_connection_flush(conn);
+}
+
+// Edge triggered, so reads until the socket is drained. Reading stops while
+// output is pending and picks up again from the EPOLLOUT that drains it.
+static void http_connection_read(Http_Connection* conn)
+{
+	while (conn->output_len == 0) {
+		if (conn->input_len == conn->input_capacity) {
+			if (conn->input_capacity >= HTTP_SERVER_MAX_BUFFER) {
+				http_connection_write(conn, http_too_large, sizeof(http_too_large) - 1);
+				conn->close = 1;
+				http_connection_flush(conn);
+				return;
+			}
+
+			char* input = realloc(conn->input, conn->input_capacity * 2);
+			if (input == NULL) {
+				http_connection_destroy(conn);
+				return;
+			}
+			conn->input = input;
+			conn->input_capacity *= 2;
+		}
+
+		ssize_t received = recv(conn->fd, conn->input + conn->input_len, conn->input_capacity - conn->input_len, 0);
+		if (received > 0) {
+			conn->input_len += received;
+			if (http_connection_process(conn))
+				return;
+			continue;
+		}
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		http_connection_destroy(conn);
+		return;
+	}
+}
+
+static void http_server_accept(Http_Server_Loop* loop)
+{
+	while (1) {
+		int fd = accept4(loop->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		Http_Connection* conn = calloc(1, sizeof(Http_Connection));
+		char* input = malloc(HTTP_SERVER_BUFFER_SIZE);
+		if (conn == NULL || input == NULL) {
+			free(conn);
+			free(input);
+			close(fd);
+			continue;
+		}
+
+		conn->fd = fd;
+		conn->loop = loop;
+		conn->input = input;
+		conn->input_capacity = HTTP_SERVER_BUFFER_SIZE;
+		conn->arena = arena_pool_lease(arena_pool_thread(), ARENA_POOL_CONNECTION);
+		http_connection_reset(conn);
+
+		struct epoll_event event = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn };
+		if (conn->arena.first == NULL || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			arena_destroy(&conn->arena);
+			free(input);
+			free(conn);
+			close(fd);
+			continue;
+		}
+
+		conn->next = loop->connections;
+		if (loop->connections)
+			loop->connections->prev = conn;
+		loop->connections = conn;
+	}
+}
+
+static void http_epoll_run(Http_Server_Loop* loop)
+{
+	struct epoll_event events[HTTP_SERVER_MAX_EVENTS];
+	uint8_t running = 1;
+	while (running) {
+		int count = epoll_wait(loop->epoll_fd, events, HTTP_SERVER_MAX_EVENTS, -1);
+		if (count < 0 && errno != EINTR)
+			break;
+
+		for (int i = 0; i < count; ++i) {
+			void* ptr = events[i].data.ptr;
+			if (ptr == &loop->wake_fd) {
+				running = 0;
+				continue;
+			}
+			if (ptr == &loop->listen_fd) {
+				http_server_accept(loop);
+				continue;
+			}
+
+			Http_Connection* conn = ptr;
+			if ((events[i].events & EPOLLOUT) && conn->output_len) {
+				if (http_connection_flush(conn))
+					continue;
+			}
+			http_connection_read(conn);
+		}
+	}
+
+	while (loop->connections)
+		http_connection_destroy(loop->connections);
+}
+
+#ifdef HTTP_HAVE_IO_URING
+static int http_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int http_uring_register(Http_Uring* ring, unsigned opcode, const void* arg, unsigned count)
+{
+	return syscall(__NR_io_uring_register, ring->fd, opcode, arg, count);
+}
+
+// Publishes the queued submissions and optionally waits for a completion
+static int http_uring_enter(Http_Uring* ring, unsigned wait)
+{
+	__atomic_store_n(ring->sq_tail, ring->sq_pending, __ATOMIC_RELEASE);
+	unsigned count = ring->sq_pending - ring->sq_submitted;
+	unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+	if (count == 0 && !wait)
+		return 0;
+
+	int submitted = syscall(__NR_io_uring_enter, ring->fd, count, wait, flags, NULL, 0);
+	if (submitted > 0)
+		ring->sq_submitted += submitted;
+	return submitted;
+}
+
+// Submissions are only queued here and go to the kernel in one call per loop
+// iteration, unless the queue fills up first
+static struct io_uring_sqe* http_uring_sqe(Http_Uring* ring)
+{
+	if (ring->sq_pending - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+		http_uring_enter(ring, 0);
+
+	struct io_uring_sqe* sqe = &ring->sqes[ring->sq_pending++ & ring->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+// Hands a receive buffer back to the kernel
+static void http_uring_recycle(Http_Uring* ring, uint16_t id)
+{
+	struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (HTTP_URING_RECV_BUFFERS - 1)];
+	buf->addr = (uintptr_t)(ring->recv_buffers + (size_t)id * HTTP_SERVER_BUFFER_SIZE);
+	buf->len = HTTP_SERVER_BUFFER_SIZE;
+	buf->bid = id;
+	__atomic_store_n(&ring->buf_ring->tail, ++ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static void http_uring_accept(Http_Server_Loop* loop)
+{
+	struct io_uring_sqe* sqe = http_uring_sqe(&loop->ring);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = loop->listen_fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = (uintptr_t)&loop->listen_fd;
+}
+
+static void http_uring_recv(Http_Connection* conn)
+{
+	struct io_uring_sqe* sqe = http_uring_sqe(&conn->loop->ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = (uintptr_t)conn | HTTP_URING_RECV;
+	conn->recv_active = 1;
+}
+
+// Shuts the socket down so that its pending receive and send complete, and frees
+// the connection once they have
+static void http_uring_destroy(Http_Connection* conn)
+{
+	if (!conn->closing) {
+		conn->closing = 1;
+		conn->loop->closing++;
+		http_connection_unlink(conn);
+		shutdown(conn->fd, SHUT_RDWR);
+	}
+	if (!conn->recv_active && !conn->send_active) {
+		conn->loop->closing--;
+		http_connection_free(conn);
+	}
+}
+
+// Queues the pending output, at most one send is in flight per connection
+static void http_uring_flush(Http_Connection* conn)
+{
+	if (conn->send_active)
+		return;
+
+	if (conn->output_sent < conn->output_len) {
+		struct io_uring_sqe* sqe = http_uring_sqe(&conn->loop->ring);
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = conn->fd;
+		sqe->addr = (uintptr_t)(conn->output + conn->output_sent);
+		sqe->len = conn->output_len - conn->output_sent;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		if (conn->output_fixed) {
+			// Registered buffers are already pinned, which is what makes zero-copy cheap
+			sqe->opcode = IORING_OP_SEND_ZC;
+			sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+			sqe->buf_index = 0;
+		}
+		sqe->user_data = (uintptr_t)conn | HTTP_URING_SEND;
+		conn->send_active = 1;
+		return;
+	}
+
+	// Registered buffers go back to the loop between responses
+	if (conn->output_fixed) {
+		http_uring_send_release(&conn->loop->ring, conn->output);
+		conn->output = NULL;
+		conn->output_capacity = 0;
+		conn->output_fixed = 0;
+	}
+	conn->output_len = conn->output_sent = 0;
+	if (conn->close)
+		http_uring_destroy(conn);
+}
+
+// Appends to the input buffer, which is only allocated once a request spans receives
+static uint8_t http_uring_buffer(Http_Connection* conn, const char* data, size_t len)
+{
+	if (conn->input_len + len > conn->input_capacity) {
+		if (conn->input_len + len > HTTP_SERVER_MAX_BUFFER) {
+			// The output cannot change under a send in flight, so only the close remains
+			if (!conn->send_active)
+				http_connection_write(conn, http_too_large, sizeof(http_too_large) - 1);
+			conn->close = 1;
+			return 0;
+		}
+
+		size_t capacity = conn->input_capacity ? conn->input_capacity : HTTP_SERVER_BUFFER_SIZE;
+		while (capacity < conn->input_len + len)
+			capacity *= 2;
+		char* input = realloc(conn->input, capacity);
+		if (input == NULL) {
+			conn->close = 1;
+			return 0;
+		}
+		conn->input = input;
+		conn->input_capacity = capacity;
+	}
+
+	memcpy(conn->input + conn->input_len, data, len);
+	conn->input_len += len;
+	return 1;
+}
+
+// Requests are handled only while no send is in flight, so handlers never touch
+// output the kernel is still reading. Bytes that arrive in the meantime are
+// buffered and handled once the send completes.
+static void http_uring_receive(Http_Connection* conn, const char* data, size_t len)
+{
+	if (conn->input_len == 0 && !conn->send_active) {
+		// The common case: the parser runs straight over the receive buffer and only
+		// the incomplete tail of a request is copied out
+		size_t consumed = http_connection_parse(conn, data, len);
+		if (consumed < len && !conn->close)
+			http_uring_buffer(conn, data + consumed, len - consumed);
+	} else if (http_uring_buffer(conn, data, len) && !conn->send_active) {
+		http_connection_consume(conn);
+	}
+	http_uring_flush(conn);
+}
+
+static void http_uring_connect(Http_Server_Loop* loop, int fd)
+{
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	Http_Connection* conn = calloc(1, sizeof(Http_Connection));
+	if (conn == NULL) {
+		close(fd);
+		return;
+	}
+
+	conn->fd = fd;
+	conn->loop = loop;
+	conn->arena = arena_pool_lease(arena_pool_thread(), ARENA_POOL_CONNECTION);
+	if (conn->arena.first == NULL) {
+		free(conn);
+		close(fd);
+		return;
+	}
+	http_connection_reset(conn);
+
+	conn->next = loop->connections;
+	if (loop->connections)
+		loop->connections->prev = conn;
+	loop->connections = conn;
+	http_uring_recv(conn);
+}
+
+static void http_uring_complete(Http_Server_Loop* loop, uint64_t user_data, int32_t res, uint32_t flags)
+{
+	Http_Uring* ring = &loop->ring;
+	if (user_data == (uintptr_t)&loop->wake_fd) {
+		loop->stopping = 1;
+		return;
+	}
+	if (user_data == (uintptr_t)&loop->listen_fd) {
+		if (res >= 0) {
+			if (loop->stopping)
+				close(res);
+			else
+				http_uring_connect(loop, res);
+		}
+		if (!(flags & IORING_CQE_F_MORE) && !loop->stopping)
+			http_uring_accept(loop);
+		return;
+	}
+
+	Http_Connection* conn = (Http_Connection*)(uintptr_t)(user_data & ~(uint64_t)HTTP_URING_OP_MASK);
+	if ((user_data & HTTP_URING_OP_MASK) == HTTP_URING_SEND) {
+		// A zero-copy send reports its result first and releases the buffer with a
+		// second notification completion
+		if (flags & IORING_CQE_F_NOTIF) {
+			res = conn->send_result;
+		} else if (flags & IORING_CQE_F_MORE) {
+			conn->send_result = res;
+			return;
+		}
+		conn->send_active = 0;
+		if (conn->closing || res <= 0) {
+			http_uring_destroy(conn);
+		} else {
+			conn->output_sent += res;
+			if (conn->output_sent == conn->output_len && conn->input_len && !conn->close) {
+				// Requests that arrived during the send
+				conn->output_len = conn->output_sent = 0;
+				http_connection_consume(conn);
+			}
+			http_uring_flush(conn);
+		}
+		return;
+	}
+
+	// The receive still counts as active while it is handled, so a close from the
+	// handler cannot free the connection under it
+	if (res > 0) {
+		uint16_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+		if (!conn->closing)
+			http_uring_receive(conn, ring->recv_buffers + (size_t)id * HTTP_SERVER_BUFFER_SIZE, res);
+		http_uring_recycle(ring, id);
+	}
+	if (!(flags & IORING_CQE_F_MORE))
+		conn->recv_active = 0;
+
+	if (conn->closing || res == 0 || (res < 0 && res != -ENOBUFS))
+		http_uring_destroy(conn);
+	else if (!conn->recv_active)
+		// Multishot receives end when the buffer ring runs dry, they are recycled by now
+		http_uring_recv(conn);
+}
+
+static void http_uring_close(Http_Uring* ring)
+{
+	if (ring->fd >= 0)
+		close(ring->fd);
+	if (ring->ring_map)
+		munmap(ring->ring_map, ring->ring_map_len);
+	if (ring->sqe_map)
+		munmap(ring->sqe_map, ring->sqe_map_len);
+	if (ring->buf_ring)
+		munmap(ring->buf_ring, HTTP_URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+	if (ring->recv_buffers)
+		munmap(ring->recv_buffers, (size_t)HTTP_URING_RECV_BUFFERS * HTTP_SERVER_BUFFER_SIZE);
+	if (ring->send_buffers)
+		munmap(ring->send_buffers, (size_t)HTTP_URING_SEND_BUFFERS * HTTP_SERVER_BUFFER_SIZE);
+	memset(ring, 0, sizeof(Http_Uring));
+	ring->fd = -1;
+}
+
+static void* http_uring_map(size_t len)
+{
+	void* ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// Sets the ring up disabled, so that it is enabled by and bound to the loop
+// thread. Fails on kernels without multishot receives or provided buffer rings,
+// which is what the automatic backend falls back to epoll on.
+static int http_uring_init(Http_Uring* ring)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	params.cq_entries = HTTP_URING_ENTRIES * 4;
+	ring->fd = http_uring_setup(HTTP_URING_ENTRIES, &params);
+	if (ring->fd < 0 && errno == EINVAL) {
+		// Deferred task running needs 6.1, the rest of what is used here 6.0
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER;
+		params.cq_entries = HTTP_URING_ENTRIES * 4;
+		ring->fd = http_uring_setup(HTTP_URING_ENTRIES, &params);
+	}
+	if (ring->fd < 0)
+		return -1;
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->ring_map_len = sq_len > cq_len ? sq_len : cq_len;
+	ring->sqe_map_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->ring_map = mmap(NULL, ring->ring_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->sqe_map = mmap(NULL, ring->sqe_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->ring_map == MAP_FAILED || ring->sqe_map == MAP_FAILED) {
+		ring->ring_map = ring->ring_map == MAP_FAILED ? NULL : ring->ring_map;
+		ring->sqe_map = ring->sqe_map == MAP_FAILED ? NULL : ring->sqe_map;
+		return -1;
+	}
+
+	char* map = ring->ring_map;
+	ring->sq_head = (unsigned*)(map + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(map + params.sq_off.tail);
+	ring->sq_mask = *(unsigned*)(map + params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->sqes = ring->sqe_map;
+	ring->cq_head = (unsigned*)(map + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(map + params.cq_off.tail);
+	ring->cq_mask = *(unsigned*)(map + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(map + params.cq_off.cqes);
+	ring->sq_pending = ring->sq_submitted = *ring->sq_tail;
+
+	// Slot i always holds submission i, so only the tail moves
+	unsigned* array = (unsigned*)(map + params.sq_off.array);
+	for (unsigned i = 0; i < params.sq_entries; ++i)
+		array[i] = i;
+
+	ring->buf_ring = http_uring_map(HTTP_URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+	ring->recv_buffers = http_uring_map((size_t)HTTP_URING_RECV_BUFFERS * HTTP_SERVER_BUFFER_SIZE);
+	if (ring->buf_ring == NULL || ring->recv_buffers == NULL)
+		return -1;
+
+	struct io_uring_buf_reg reg = { .ring_addr = (uintptr_t)ring->buf_ring, .ring_entries = HTTP_URING_RECV_BUFFERS, .bgid = 0 };
+	if (http_uring_register(ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		return -1;
+	for (uint16_t i = 0; i < HTTP_URING_RECV_BUFFERS; ++i)
+		http_uring_recycle(ring, i);
+
+	// Best effort, registration counts against RLIMIT_MEMLOCK
+	ring->send_buffers = http_uring_map((size_t)HTTP_URING_SEND_BUFFERS * HTTP_SERVER_BUFFER_SIZE);
+	if (ring->send_buffers) {
+		struct iovec iov = { .iov_base = ring->send_buffers, .iov_len = (size_t)HTTP_URING_SEND_BUFFERS * HTTP_SERVER_BUFFER_SIZE };
+		if (http_uring_register(ring, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+			munmap(ring->send_buffers, iov.iov_len);
+			ring->send_buffers = NULL;
+		}
+	}
+	ring->send_free_count = HTTP_URING_SEND_BUFFERS;
+	for (uint16_t i = 0; i < HTTP_URING_SEND_BUFFERS; ++i)
+		ring->send_free[i] = HTTP_URING_SEND_BUFFERS - 1 - i;
+	return 0;
+}
+
+static void http_uring_run(Http_Server_Loop* loop)
+{
+	Http_Uring* ring = &loop->ring;
+	if (http_uring_register(ring, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0)
+		return;
+
+	struct io_uring_sqe* sqe = http_uring_sqe(ring);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = loop->wake_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = (uintptr_t)&loop->wake_fd;
+	http_uring_accept(loop);
+
+	// After a stop, runs on until every closing connection has its last completion
+	while (!loop->stopping || loop->connections || loop->closing) {
+		if (loop->stopping) {
+			while (loop->connections)
+				http_uring_destroy(loop->connections);
+			if (!loop->closing)
+				break;
+		}
+
+		if (http_uring_enter(ring, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			break;
+
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+			uint64_t user_data = cqe->user_data;
+			int32_t res = cqe->res;
+			uint32_t flags = cqe->flags;
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+			http_uring_complete(loop, user_data, res, flags);
+		}
+	}
+}
+#endif
+
+static void* http_server_loop_run(void* arg)
+{
+	Http_Server_Loop* loop = arg;
+
+	// Best effort, keeps each loop's connections in one core's caches
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(loop->index % CPU_SETSIZE, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+#ifdef HTTP_HAVE_IO_URING
+	if (loop->server->backend == HTTP_SERVER_IO_URING)
+		http_uring_run(loop);
+	else
+		http_epoll_run(loop);
+#else
+	http_epoll_run(loop);
+#endif
+
+	loop->stats = *http_stats_thread();
+	arena_pool_destroy(arena_pool_thread());
+	return NULL;
+}
+
+static int http_server_listen(Http_Server* server)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(server->config.port) };
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (server->config.host && inet_pton(AF_INET, server->config.host, &addr.sin_addr) != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	int one = 1;
+	int backlog = server->config.backlog ? server->config.backlog : SOMAXCONN;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+		bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+		listen(fd, backlog) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	return fd;
+}
+
+static int http_server_loop_init(Http_Server* server, Http_Server_Loop* loop, int index)
+{
+	loop->server = server;
+	loop->index = index;
+	loop->connections = NULL;
+	loop->listen_fd = http_server_listen(server);
+	loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (loop->listen_fd < 0 || loop->wake_fd < 0)
+		return -1;
+
+#ifdef HTTP_HAVE_IO_URING
+	loop->closing = 0;
+	loop->stopping = 0;
+	if (server->backend == HTTP_SERVER_IO_URING)
+		return http_uring_init(&loop->ring);
+#endif
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0)
+		return -1;
+
+	struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = &loop->listen_fd };
+	struct epoll_event wake_event = { .events = EPOLLIN, .data.ptr = &loop->wake_fd };
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &listen_event) < 0 ||
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &wake_event) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void http_server_loop_close(Http_Server_Loop* loop)
+{
+	if (loop->listen_fd >= 0)
+		close(loop->listen_fd);
+	if (loop->epoll_fd >= 0)
+		close(loop->epoll_fd);
+	if (loop->wake_fd >= 0)
+		close(loop->wake_fd);
+	loop->listen_fd = loop->epoll_fd = loop->wake_fd = -1;
+#ifdef HTTP_HAVE_IO_URING
+	http_uring_close(&loop->ring);
+#endif
+}
+
+Http_Server* http_server_create(const Http_Server_Config* config)
+{
+	if (config == NULL || config->handler == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	Http_Server* server = calloc(1, sizeof(Http_Server));
+	if (server == NULL)
+		return NULL;
+
+	server->config = *config;
+	server->loop_count = config->threads > 0 ? config->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (server->loop_count < 1)
+		server->loop_count = 1;
+
+	server->loops = calloc(server->loop_count, sizeof(Http_Server_Loop));
+	if (server->loops == NULL) {
+		free(server);
+		return NULL;
+	}
+	for (int i = 0; i < server->loop_count; ++i) {
+		server->loops[i].listen_fd = server->loops[i].epoll_fd = server->loops[i].wake_fd = -1;
+#ifdef HTTP_HAVE_IO_URING
+		server->loops[i].ring.fd = -1;
+#endif
+	}
+
+	return server;
+}
+
+Http_Server_Backend http_server_backend(const Http_Server* server)
+{
+	return server->backend;
+}
+
+void http_server_stats(const Http_Server* server, Http_Stats* stats)
+{
+	http_stats_reset(stats);
+	for (int i = 0; i < server->loop_count; ++i)
+		http_stats_merge(stats, &server->loops[i].stats);
+}
+
+static void http_server_loop_wake(Http_Server_Loop* loop)
+{
+	uint64_t one = 1;
+	ssize_t written = write(loop->wake_fd, &one, sizeof(one));
+	(void)written;
+}
+
+static int http_server_init_loops(Http_Server* server)
+{
+	for (int i = 0; i < server->loop_count; ++i) {
+		if (http_server_loop_init(server, &server->loops[i], i) < 0) {
+			int error = errno;
+			for (int j = 0; j <= i; ++j)
+				http_server_loop_close(&server->loops[j]);
+			errno = error;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int http_server_start(Http_Server* server)
+{
+	int started = 0;
+	int error = 0;
+
+#ifdef HTTP_HAVE_IO_URING
+	server->backend = server->config.backend == HTTP_SERVER_EPOLL ? HTTP_SERVER_EPOLL : HTTP_SERVER_IO_URING;
+#else
+	if (server->config.backend == HTTP_SERVER_IO_URING) {
+		errno = ENOSYS;
+		return -1;
+	}
+	server->backend = HTTP_SERVER_EPOLL;
+#endif
+
+	if (http_server_init_loops(server) < 0) {
+		error = errno;
+		if (server->config.backend == HTTP_SERVER_AUTO && server->backend == HTTP_SERVER_IO_URING) {
+			server->backend = HTTP_SERVER_EPOLL;
+			error = http_server_init_loops(server) < 0 ? errno : 0;
+		}
+	}
+
+	for (; started < server->loop_count && !error; ++started)
+		error = pthread_create(&server->loops[started].thread, NULL, http_server_loop_run, &server->loops[started]);
+
+	if (error) {
+		// Stop the loops that did start
+		for (int i = 0; i < started - 1; ++i) {
+			http_server_loop_wake(&server->loops[i]);
+			pthread_join(server->loops[i].thread, NULL);
+		}
+		for (int i = 0; i < server->loop_count; ++i)
+			http_server_loop_close(&server->loops[i]);
+		errno = error;
+		return -1;
+	}
+
+	server->running = 1;
+	return 0;
+}
+
+void http_server_stop(Http_Server* server)
+{
+	if (!server->running)
+		return;
+
+	for (int i = 0; i < server->loop_count; ++i)
+		http_server_loop_wake(&server->loops[i]);
+	for (int i = 0; i < server->loop_count; ++i) {
+		pthread_join(server->loops[i].thread, NULL);
+		http_server_loop_close(&server->loops[i]);
+	}
+	server->running = 0;
+}
+
+void http_server_destroy(Http_Server* server)
+{
+	if (server == NULL)
+		return;
+
+	http_server_stop(server);
+	free(server->loops);
+	free(server);
+}
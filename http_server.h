@@ -0,0 +1,68 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "http_parser.h"
+#include "http_stats.h"
+
+// Multi-core HTTP/1.1 server core (Linux). Every loop thread owns an epoll
+// instance or an io_uring and its own SO_REUSEPORT listener, so the kernel
+// spreads incoming connections across cores and connections never move between
+// threads. Each connection has its own parser, input and output buffers and an
+// arena leased from the thread's pool, which is reset between keep-alive requests.
+//
+// The io_uring backend accepts and receives with multishot requests into a ring
+// of provided buffers the parser reads in place, builds responses in registered
+// buffers it sends zero-copy and submits once per loop iteration. It needs Linux 6.0.
+
+typedef struct Http_Server Http_Server;
+typedef struct Http_Connection Http_Connection;
+
+// Called on the connection's loop thread once a request is complete. The request
+// and its arena are only valid during the call; queue the response with
+// http_connection_write, it is sent when the handler returns.
+typedef void (*Http_Handler)(Http_Connection* connection, const Http_Request* request, void* user_data);
+
+typedef enum {
+	HTTP_SERVER_AUTO,		// io_uring if the kernel supports it, epoll otherwise
+	HTTP_SERVER_EPOLL,
+	HTTP_SERVER_IO_URING
+} Http_Server_Backend;
+
+typedef struct {
+	const char* host;		// IPv4 address to bind, NULL for all interfaces
+	uint16_t port;
+	int threads;			// Loop threads, 0 for one per online core
+	int backlog;			// 0 for SOMAXCONN
+	Http_Handler handler;
+	void* user_data;
+	Http_Server_Backend backend;
+	const Http_Limits* limits;	// NULL for http_default_limits; must outlive the server
+} Http_Server_Config;
+
+// System calls fail with -1 and errno set, as they do
+Http_Server* http_server_create(const Http_Server_Config* config);
+// Binds the listeners and starts the loop threads
+int http_server_start(Http_Server* server);
+// Wakes every loop, closes their connections and joins the threads
+void http_server_stop(Http_Server* server);
+void http_server_destroy(Http_Server* server);
+// The backend the server runs on once started
+Http_Server_Backend http_server_backend(const Http_Server* server);
+// Parser stats summed over the loop threads, complete once the server is stopped
+void http_server_stats(const Http_Server* server, Http_Stats* stats);
+
+// Queues response bytes; returns HTTP_OOM if the output buffer cannot grow
+uint8_t http_connection_write(Http_Connection* connection, const char* data, size_t len);
+// Queues the pieces of e.g. an Http_Builder in one go. Under epoll they are sent right
+// away and only what the socket does not take is copied, under io_uring they are copied.
+uint8_t http_connection_writev(Http_Connection* connection, const struct iovec* iov, int count);
+// Closes the connection once the queued output has been sent
+void http_connection_close(Http_Connection* connection);
+// Arena of the request being handled, reset after the handler returns
+Arena* http_connection_arena(Http_Connection* connection);
+
+#endif
@@ -0,0 +1,30 @@
+#include <string.h>
+
+#include "http_stats.h"
+
+static _Thread_local Http_Stats http_thread_stats;
+
+Http_Stats* http_stats_thread(void)
+{
+	return &http_thread_stats;
+}
+
+void http_stats_reset(Http_Stats* stats)
+{
+	memset(stats, 0, sizeof(Http_Stats));
+}
+
+void http_stats_merge(Http_Stats* total, const Http_Stats* stats)
+{
+	for (int i = 0; i < HTTP_PHASE_COUNT; ++i)
+		total->cycles[i] += stats->cycles[i];
+	total->runs += stats->runs;
+	total->messages += stats->messages;
+	total->bytes += stats->bytes;
+	total->headers += stats->headers;
+	if (stats->max_headers > total->max_headers)
+		total->max_headers = stats->max_headers;
+	total->arena_bytes += stats->arena_bytes;
+	for (int i = 0; i < 256; ++i)
+		total->errors[i] += stats->errors[i];
+}
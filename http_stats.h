@@ -0,0 +1,61 @@
+#ifndef HTTP_STATS_H
+#define HTTP_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// Per-phase parser instrumentation, compiled in with HTTP_STATS defined (the
+// HTTP_STATS CMake option). Without it the parser carries no trace of it and
+// the stats stay zero. Each thread counts into its own Http_Stats without
+// synchronisation; threads hand theirs over once they are done and the totals
+// are summed with http_stats_merge.
+
+typedef enum {
+	HTTP_PHASE_INDEX,			// Structural index of the head (http_index_update)
+	HTTP_PHASE_START_LINE,
+	HTTP_PHASE_HEADERS,
+	HTTP_PHASE_BODY,			// Chunked trailers included
+	HTTP_PHASE_COUNT
+} Http_Phase;
+
+typedef struct {
+	uint64_t cycles[HTTP_PHASE_COUNT];
+	uint64_t runs;				// Parser calls, a message resumed on more data takes several
+	uint64_t messages;			// Messages parsed to completion
+	uint64_t bytes;				// Bytes the parser consumed
+	uint64_t headers;			// Headers and trailers of the completed messages
+	uint64_t max_headers;
+	uint64_t arena_bytes;		// Arena used by the completed messages
+	uint64_t errors[256];		// Failed messages by status code
+} Http_Stats;
+
+static inline uint64_t http_stats_cycles(void)
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// The calling thread's stats, which the parser counts into
+Http_Stats* http_stats_thread(void);
+void http_stats_reset(Http_Stats* stats);
+// Adds stats to total, e.g. each thread's stats once it is joined
+void http_stats_merge(Http_Stats* total, const Http_Stats* stats);
+
+#endif
@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "http_parser.h"
+#include "http_query.h"
 
 #define ARENA_IMPLEMENTATION
 #include "arena.h"
@@ -9,7 +10,7 @@
 void test_http_parser(char* buffer)
 {
 	Http_Request req = {0};
-	Arena arena = arena_create(0x10000);
+	Arena arena = arena_pool_lease(arena_pool_thread(), ARENA_POOL_REQUEST);
 	uint8_t status = http_parse_request(buffer, strlen(buffer), &req, &arena);
 	if (status) {
 		char error[50];
@@ -19,6 +20,120 @@ void test_http_parser(char* buffer)
 	else {
 		printf("Success!\n");
 	}
+	arena_pool_return(arena_pool_thread(), &arena, ARENA_POOL_REQUEST);
+}
+
+// Feeds the request a few bytes at a time, as if it arrived over several reads
+void test_http_parser_incremental(char* request, size_t chunk_size, uint8_t flags)
+{
+	char buffer[1024];
+	size_t len = strlen(request);
+	size_t received = 0;
+
+	Http_Request req = {0};
+	Http_Parser parser;
+	http_parser_init(&parser, flags);
+	Arena arena = arena_create(0x1000);
+
+	uint8_t status = HTTP_END_OF_CONTENT;
+	while (status == HTTP_END_OF_CONTENT && received < len) {
+		size_t chunk = len - received < chunk_size ? len - received : chunk_size;
+		memcpy(buffer + received, request + received, chunk);
+		received += chunk;
+		status = http_parser_execute(&parser, buffer, received, &req, &arena);
+	}
+
+	if (status) {
+		char error[50];
+		http_get_error_str(status, error, sizeof(error));
+		printf("HTTP error %d: %s\n", status, error);
+	}
+	else {
+		printf("Success! (%zu headers, %zu body bytes)\n", req.headers.count, req.body_len);
+	}
+	arena_destroy(&arena);
+}
+
+void test_http_parser_pipeline(char* buffer)
+{
+	Http_Request requests[8];
+	Arena arena = arena_create(0x1000);
+	size_t consumed;
+	uint8_t status;
+	size_t count = http_parse_requests(buffer, strlen(buffer), requests, 8, 0, &consumed, &status, &arena);
+	if (status && status != HTTP_END_OF_CONTENT) {
+		char error[50];
+		http_get_error_str(status, error, sizeof(error));
+		printf("HTTP error %d: %s\n", status, error);
+	}
+	printf("Parsed %zu requests, next one starts at byte %zu\n", count, consumed);
+	arena_destroy(&arena);
+}
+
+void print_body_chunk(void* user_data, const char* data, size_t len)
+{
+	(void)user_data;
+	printf("Body chunk: %.*s\n", (int)len, data);
+}
+
+void test_http_parser_chunked(char* request)
+{
+	Http_Request req = {0};
+	Http_Parser parser;
+	http_parser_init(&parser, 0);
+	parser.on_body = print_body_chunk;
+	Arena arena = arena_create(0x1000);
+
+	uint8_t status = http_parser_execute(&parser, request, strlen(request), &req, &arena);
+	if (status) {
+		char error[50];
+		http_get_error_str(status, error, sizeof(error));
+		printf("HTTP error %d: %s\n", status, error);
+	}
+	else {
+		printf("Success! (%zu body bytes, %zu trailers)\n", req.body_len, req.trailers.count);
+	}
+	arena_destroy(&arena);
+}
+
+void test_http_response(char* buffer)
+{
+	Http_Response res = {0};
+	Arena arena = arena_create(0x1000);
+	uint8_t status = http_parse_response(buffer, strlen(buffer), &res, 0, &arena);
+	if (status) {
+		char error[50];
+		http_get_error_str(status, error, sizeof(error));
+		printf("HTTP error %d: %s\n", status, error);
+	}
+	else {
+		printf("Success! (status %d, %zu body bytes)\n", res.status_code, res.body_len);
+	}
+	arena_destroy(&arena);
+}
+
+void test_http_query(char* buffer)
+{
+	Http_Request req = {0};
+	Arena arena = arena_create(0x1000);
+	uint8_t status = http_parse_request(buffer, strlen(buffer), &req, &arena);
+
+	Http_Query_Iter iter;
+	Http_Query_Param param;
+	http_query_init(&iter, http_uri_part(&req, req.uri.query), req.uri.query.len);
+	while (!status && http_query_next(&iter, &param)) {
+		const char* value;
+		size_t value_len;
+		status = http_query_decode_alloc(param.value, param.value_len, &value, &value_len, &arena);
+		if (!status)
+			printf("Query param %.*s = %.*s\n", (int)param.name_len, param.name, (int)value_len, value);
+	}
+
+	if (status) {
+		char error[50];
+		http_get_error_str(status, error, sizeof(error));
+		printf("HTTP error %d: %s\n", status, error);
+	}
 	arena_destroy(&arena);
 }
 
@@ -45,6 +160,22 @@ int main()
 	//test_http_parser("GET /hello.txt HTTP1.1\r\nHost: localhost;\r\nUser-Agent: FakeFox\r\n\r\n");
 	//test_http_parser("GET /hello.txt HTTP1.1\r\nHost: localhost;\r\nUser-Agent: FakeFox\r\nHello body!");
 	test_http_parser("GET /hello.txt HTTP/1.1\r\nHost: localhost;\r\nUser-Agent: FakeFox\r\nContent-Length: 12\r\n\r\nHello world!");
+	test_http_parser_incremental("GET /hello.txt HTTP/1.1\r\nHost: localhost;\r\nUser-Agent: FakeFox\r\nContent-Length: 12\r\n\r\nHello world!", 3, 0);
+	test_http_parser_incremental("GET /hello.txt HTTP/1.1\r\nHost: localhost;\r\nUser-Agent: FakeFox\r\nContent-Length: 12\r\n\r\nHello world!", 3, HTTP_PARSE_ZERO_COPY);
+
+	test_http_parser_pipeline("GET /a HTTP/1.1\r\nHost: localhost\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET /c HTTP/1.1\r\nHo");
+	// Authority-form hosts: an IPv6 literal and a reg-name no scheme could be; then an empty target
+	test_http_parser("CONNECT [::1]:443 HTTP/1.1\r\n\r\n");
+	test_http_parser("CONNECT my_host~1:443 HTTP/1.1\r\n\r\n");
+	test_http_parser("GET  HTTP/1.1\r\n\r\n");
+	// Smuggling attempts: chunked that is not the last coding, and Content-Lengths that disagree
+	test_http_parser("POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: gzip\r\n\r\n5\r\nhello\r\n0\r\n\r\n");
+	test_http_parser_pipeline("POST /a HTTP/1.1\r\nContent-Length: 0\r\nContent-Length: 5\r\n\r\nhelloGET /b HTTP/1.1\r\n\r\n");
+	test_http_parser_chunked("POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nHello \r\n6;last\r\nworld!\r\n0\r\nExpires: never\r\n\r\n");
+	test_http_query("GET /search?q=hello+world%21&&page=2&lang HTTP/1.1\r\n\r\n");
+	test_http_query("GET /search?q=100%zz HTTP/1.1\r\n\r\n");
+	test_http_response("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 12\r\n\r\nHello world!");
 
+	arena_pool_destroy(arena_pool_thread());
 	return 0;
 }
@@ -0,0 +1,42 @@
+#ifndef HTTP_TEST_H
+#define HTTP_TEST_H
+
+#include <stdio.h>
+
+// Checks for the test executables. A failed check reports where it failed and
+// the test goes on, main returns test_failures != 0 so ctest sees the failure.
+static int test_failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+} while (0)
+
+// Compares two integers and prints both when they differ
+#define CHECK_EQ(actual, expected) do { \
+	long long test_actual = (long long)(actual); \
+	long long test_expected = (long long)(expected); \
+	if (test_actual != test_expected) { \
+		fprintf(stderr, "%s:%d: check failed: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, test_actual, test_expected); \
+		test_failures++; \
+	} \
+} while (0)
+
+// Compares a pointer and length against a string literal
+#define CHECK_STR(data, len, expected) do { \
+	size_t test_len = (len); \
+	if (test_len != sizeof(expected) - 1 || memcmp((data), (expected), test_len) != 0) { \
+		fprintf(stderr, "%s:%d: check failed: %s is \"%.*s\", expected \"%s\"\n", __FILE__, __LINE__, #data, (int)test_len, (const char*)(data), (expected)); \
+		test_failures++; \
+	} \
+} while (0)
+
+#define RUN_TEST(test) do { \
+	int test_before = test_failures; \
+	test(); \
+	printf("%s %s\n", test_failures == test_before ? "ok  " : "FAIL", #test); \
+} while (0)
+
+#endif
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "http_builder.h"
+#include "test.h"
+
+// Joins the pieces the way writev would send them
+static size_t flatten(const Http_Builder* builder, char* out)
+{
+	size_t len = 0;
+	for (int i = 0; i < builder->count; ++i) {
+		memcpy(out + len, builder->iov[i].iov_base, builder->iov[i].iov_len);
+		len += builder->iov[i].iov_len;
+	}
+	return len;
+}
+
+static void test_response(void)
+{
+	char out[256];
+	Http_Builder builder;
+	http_builder_init(&builder, 200);
+	CHECK_EQ(http_builder_header(&builder, "Content-Type", 12, "text/plain; charset=utf-8", 25), HTTP_SUCCESS);
+	CHECK_EQ(http_builder_header(&builder, "X-Tab", 5, "a\tb", 3), HTTP_SUCCESS);
+	CHECK_EQ(http_builder_body(&builder, "hi", 2), HTTP_SUCCESS);
+	size_t len = flatten(&builder, out);
+	CHECK_EQ(len, builder.len);
+	CHECK_STR(out, len, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\nX-Tab: a\tb\r\nContent-Length: 2\r\n\r\nhi");
+}
+
+// Names and values that would break out of their line are refused, and so is everything after them
+static void test_header_injection(void)
+{
+	static const struct { const char* name; size_t name_len; const char* value; size_t value_len; uint8_t error; } cases[] = {
+		{ "", 0, "a", 1, HTTP_HEADER_EXPECTED },
+		{ "X Y", 3, "a", 1, HTTP_HEADER_EXPECTED },
+		{ "X:Y", 3, "a", 1, HTTP_HEADER_EXPECTED },
+		{ "X\r\nY", 4, "a", 1, HTTP_HEADER_EXPECTED },
+		{ "X", 1, "a\r\nSet-Cookie: b", 16, HTTP_INVALID_HEADER_BYTE },
+		{ "X", 1, "a\nb", 3, HTTP_INVALID_HEADER_BYTE },
+		{ "X", 1, "a\0b", 3, HTTP_INVALID_HEADER_BYTE },
+		{ "X", 1, "a\x7F", 2, HTTP_INVALID_HEADER_BYTE },
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		Http_Builder builder;
+		http_builder_init(&builder, 200);
+		int count = builder.count;
+		CHECK_EQ(http_builder_header(&builder, cases[i].name, cases[i].name_len, cases[i].value, cases[i].value_len), cases[i].error);
+		CHECK_EQ(builder.count, count);
+		CHECK_EQ(http_builder_header(&builder, "X", 1, "a", 1), cases[i].error);
+		CHECK_EQ(http_builder_end(&builder), cases[i].error);
+	}
+}
+
+int main(void)
+{
+	RUN_TEST(test_response);
+	RUN_TEST(test_header_injection);
+	return test_failures != 0;
+}
@@ -0,0 +1,174 @@
+#include <string.h>
+
+#include <zlib.h>
+
+#include "http_parser.h"
+#include "http_decode.h"
+#include "test.h"
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+#define PLAIN_LEN 200000
+
+static char plain[PLAIN_LEN];
+static unsigned char gzipped[PLAIN_LEN];
+static size_t gzipped_len;
+
+// window_bits 16 + 15 writes the gzip wrapper, 15 the zlib one
+static size_t compress_plain(unsigned char* out, size_t capacity, int window_bits)
+{
+	z_stream stream = {0};
+	deflateInit2(&stream, 9, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+	stream.next_in = (Bytef*)plain;
+	stream.avail_in = PLAIN_LEN;
+	stream.next_out = out;
+	stream.avail_out = capacity;
+	deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+	return capacity - stream.avail_out;
+}
+
+static size_t streamed;
+
+static void count_body(void* user_data, const char* data, size_t len)
+{
+	(void)user_data;
+	(void)data;
+	streamed += len;
+}
+
+static uint8_t count_header(void* user_data, const char* name, size_t name_len, const char* value, size_t value_len)
+{
+	(void)name;
+	(void)name_len;
+	(void)value;
+	(void)value_len;
+	++*(size_t*)user_data;
+	return HTTP_SUCCESS;
+}
+
+static const Http_Callbacks header_callbacks = { .on_header = count_header };
+
+// Sends head followed by body with a Content-Length, in pieces of chunk_size bytes
+static uint8_t parse_encoded(const char* head, const unsigned char* body, size_t body_len, size_t chunk_size, size_t max_output,
+	const Http_Limits* limits, uint8_t streaming, Http_Request* req, Arena* arena)
+{
+	static char buffer[PLAIN_LEN + 0x1000];
+	size_t len = sprintf(buffer, "%sContent-Length: %zu\r\n\r\n", head, body_len);
+	memcpy(buffer + len, body, body_len);
+	len += body_len;
+
+	size_t headers = 0;
+	Http_Parser parser;
+	http_parser_init(&parser, 0);
+	if (limits)
+		parser.limits = limits;
+	if (streaming == 1)
+		parser.on_body = count_body;
+	if (streaming == 2) {
+		parser.callbacks = &header_callbacks;
+		parser.user_data = &headers;
+	}
+	Http_Decoder decoder;
+	http_decoder_init(&decoder, 1000, max_output);
+	parser.decoder = &decoder;
+	streamed = 0;
+
+	uint8_t status = HTTP_END_OF_CONTENT;
+	for (size_t received = chunk_size; status == HTTP_END_OF_CONTENT; received += chunk_size) {
+		if (received > len)
+			received = len;
+		status = http_parser_execute(&parser, buffer, received, req, arena);
+		if (received == len)
+			break;
+	}
+	return status;
+}
+
+static void test_decode(void)
+{
+	static unsigned char deflated[PLAIN_LEN];
+	size_t deflated_len = compress_plain(deflated, sizeof(deflated), 15);
+
+	for (size_t chunk = 1; chunk < 0x100000; chunk *= 37) {
+		Http_Request req = {0};
+		Arena arena = arena_create(0x10000);
+		CHECK_EQ(parse_encoded("POST / HTTP/1.1\r\nContent-Encoding: gzip\r\n", gzipped, gzipped_len, chunk, 0, NULL, 0, &req, &arena), HTTP_SUCCESS);
+		CHECK(req.body_len == PLAIN_LEN && memcmp(req.body, plain, PLAIN_LEN) == 0);
+		http_request_reset(&req, &arena);
+		CHECK_EQ(parse_encoded("POST / HTTP/1.1\r\nContent-Encoding: deflate\r\n", deflated, deflated_len, chunk, 0, NULL, 1, &req, &arena), HTTP_SUCCESS);
+		CHECK_EQ(streamed, PLAIN_LEN);
+		arena_destroy(&arena);
+	}
+}
+
+// Codings are case-insensitive and OWS is not part of the value
+static void test_coding_names(void)
+{
+	const char* heads[] = {
+		"POST / HTTP/1.1\r\nContent-Encoding: GZIP \r\n",
+		"POST / HTTP/1.1\r\nContent-Encoding:\t x-gzip\t\r\n",
+	};
+	for (size_t i = 0; i < sizeof(heads) / sizeof(heads[0]); ++i) {
+		Http_Request req = {0};
+		Arena arena = arena_create(0x10000);
+		CHECK_EQ(parse_encoded(heads[i], gzipped, gzipped_len, 0x1000, 0, NULL, 0, &req, &arena), HTTP_SUCCESS);
+		CHECK_EQ(req.body_len, PLAIN_LEN);
+		arena_destroy(&arena);
+	}
+
+	Http_Request req = {0};
+	Arena arena = arena_create(0x10000);
+	CHECK_EQ(parse_encoded("POST / HTTP/1.1\r\nContent-Encoding: br\r\n", gzipped, gzipped_len, 0x1000, 0, NULL, 0, &req, &arena), HTTP_UNSUPPORTED_ENCODING);
+	arena_destroy(&arena);
+}
+
+// Stacked codings are refused the same way on one line or over several
+static void test_stacked_codings(void)
+{
+	const char* heads[] = {
+		"POST / HTTP/1.1\r\nContent-Encoding: gzip, gzip\r\n",
+		"POST / HTTP/1.1\r\nContent-Encoding: gzip\r\nContent-Encoding: gzip\r\n",
+		"POST / HTTP/1.1\r\nContent-Encoding: gzip\r\nHost: a\r\nContent-Encoding: identity\r\n",
+	};
+	for (size_t i = 0; i < sizeof(heads) / sizeof(heads[0]); ++i) {
+		for (uint8_t streaming = 0; streaming <= 2; ++streaming) {
+			Http_Request req = {0};
+			Arena arena = arena_create(0x10000);
+			CHECK_EQ(parse_encoded(heads[i], gzipped, gzipped_len, 0x1000, 0, NULL, streaming, &req, &arena), HTTP_UNSUPPORTED_ENCODING);
+			arena_destroy(&arena);
+		}
+	}
+}
+
+// Without a cap of its own the decoder holds the body to max_body, however small it was compressed
+static void test_output_cap(void)
+{
+	Http_Limits limits = http_default_limits;
+	limits.max_body = 50000;
+	CHECK(gzipped_len < limits.max_body);
+
+	Http_Request req = {0};
+	Arena arena = arena_create(0x10000);
+	CHECK_EQ(parse_encoded("POST / HTTP/1.1\r\nContent-Encoding: gzip\r\n", gzipped, gzipped_len, 0x1000, 0, &limits, 1, &req, &arena), HTTP_BODY_TOO_LARGE);
+	http_request_reset(&req, &arena);
+	CHECK_EQ(parse_encoded("POST / HTTP/1.1\r\nContent-Encoding: gzip\r\n", gzipped, gzipped_len, 0x1000, PLAIN_LEN, &limits, 1, &req, &arena), HTTP_SUCCESS);
+	CHECK_EQ(streamed, PLAIN_LEN);
+	http_request_reset(&req, &arena);
+	CHECK_EQ(parse_encoded("POST / HTTP/1.1\r\nContent-Encoding: gzip\r\n", gzipped, gzipped_len, 0x1000, 1000, NULL, 1, &req, &arena), HTTP_BODY_TOO_LARGE);
+	arena_destroy(&arena);
+}
+
+int main(void)
+{
+	for (size_t i = 0; i < PLAIN_LEN; ++i)
+		plain[i] = "abcdefgh"[(i * 7 + i / 13) % 8];
+	gzipped_len = compress_plain(gzipped, sizeof(gzipped), 16 + 15);
+
+	RUN_TEST(test_decode);
+	RUN_TEST(test_coding_names);
+	RUN_TEST(test_stacked_codings);
+	RUN_TEST(test_output_cap);
+	return test_failures != 0;
+}
@@ -0,0 +1,54 @@
+#include <string.h>
+
+#include "hashtable.h"
+#include "test.h"
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+// hashtable_set keeps a copy, so the caller's data may change or go away
+static void test_set_copies(void)
+{
+	hashtable_t* ht = hashtable_alloc();
+	char value[8] = "first";
+	CHECK(hashtable_set(ht, "key", value, sizeof(value)));
+	strcpy(value, "changed");
+	const char* stored = hashtable_get(ht, "key");
+	CHECK(stored != value && strcmp(stored, "first") == 0);
+
+	CHECK(hashtable_set(ht, "key", "second", 7));
+	CHECK(strcmp(hashtable_get(ht, "key"), "second") == 0);
+	CHECK_EQ(ht->count, 1);
+	hashtable_free(ht);
+}
+
+static void test_put_references(void)
+{
+	static int values[100];
+	Arena arena = arena_create(0x1000);
+	hashtable_t ht;
+	CHECK(hashtable_init(&ht, 0, HASHTABLE_CASE_INSENSITIVE | HASHTABLE_COPY_KEYS, &arena));
+	for (int i = 0; i < 100; ++i) {
+		char key[16];
+		int len = snprintf(key, sizeof(key), "Key-%d", i);
+		CHECK(hashtable_put_n(&ht, key, len, &values[i]));
+	}
+	CHECK_EQ(ht.count, 100);
+	CHECK(hashtable_get(&ht, "KEY-42") == &values[42]);
+	CHECK(hashtable_get_n(&ht, "key-7 and more", 5) == &values[7]);
+	CHECK(hashtable_get(&ht, "key-100") == NULL);
+
+	// Switching a key between both kinds of value
+	CHECK(hashtable_set(&ht, "key-1", "copy", 5));
+	CHECK(strcmp(hashtable_get(&ht, "key-1"), "copy") == 0);
+	CHECK(hashtable_put(&ht, "key-1", &values[0]));
+	CHECK(hashtable_get(&ht, "key-1") == &values[0]);
+	arena_destroy(&arena);
+}
+
+int main(void)
+{
+	RUN_TEST(test_set_copies);
+	RUN_TEST(test_put_references);
+	return test_failures != 0;
+}
@@ -0,0 +1,394 @@
+#include <string.h>
+
+#include "http_parser.h"
+#include "http_scan.h"
+#include "test.h"
+
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+static const char simple_request[] = "GET /hello.txt HTTP/1.1\r\nHost: localhost\r\nUser-Agent: FakeFox\r\nContent-Length: 12\r\n\r\nHello world!";
+
+// Feeds the request a few bytes at a time, as if it arrived over several reads
+static uint8_t parse_incremental(const char* request, size_t chunk_size, uint8_t flags, Http_Request* req, Arena* arena)
+{
+	static char buffer[0x4000];
+	size_t len = strlen(request);
+	size_t received = 0;
+
+	Http_Parser parser;
+	http_parser_init(&parser, flags);
+	uint8_t status = HTTP_END_OF_CONTENT;
+	while (status == HTTP_END_OF_CONTENT && received < len) {
+		size_t chunk = len - received < chunk_size ? len - received : chunk_size;
+		memcpy(buffer + received, request + received, chunk);
+		received += chunk;
+		status = http_parser_execute(&parser, buffer, received, req, arena);
+	}
+	return status;
+}
+
+static void test_simple_request(void)
+{
+	Http_Request req = {0};
+	Arena arena = arena_create(0x1000);
+	CHECK_EQ(http_parse_request(simple_request, strlen(simple_request), &req, &arena), HTTP_SUCCESS);
+	CHECK_STR(req.method, req.method_len, "GET");
+	CHECK_STR(req.target, req.target_len, "/hello.txt");
+	CHECK_EQ(req.minor_version, 1);
+	CHECK_EQ(req.headers.count, 3);
+	CHECK_STR(req.body, req.body_len, "Hello world!");
+	arena_destroy(&arena);
+}
+
+static void test_incremental(void)
+{
+	for (uint8_t flags = 0; flags <= HTTP_PARSE_ZERO_COPY; ++flags) {
+		for (size_t chunk = 1; chunk < sizeof(simple_request); chunk += 7) {
+			Http_Request req = {0};
+			Arena arena = arena_create(0x1000);
+			CHECK_EQ(parse_incremental(simple_request, chunk, flags, &req, &arena), HTTP_SUCCESS);
+			CHECK_EQ(req.headers.count, 3);
+			CHECK_STR(req.body, req.body_len, "Hello world!");
+			arena_destroy(&arena);
+		}
+	}
+}
+
+static void test_pipeline(void)
+{
+	const char* buffer = "GET /a HTTP/1.1\r\nHost: localhost\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET /c HTTP/1.1\r\nHo";
+	Http_Request requests[8];
+	Arena arena = arena_create(0x1000);
+	size_t consumed;
+	uint8_t status;
+	size_t count = http_parse_requests(buffer, strlen(buffer), requests, 8, 0, &consumed, &status, &arena);
+	CHECK_EQ(count, 2);
+	CHECK_EQ(status, HTTP_END_OF_CONTENT);
+	CHECK_EQ(consumed, strlen(buffer) - strlen("GET /c HTTP/1.1\r\nHo"));
+	CHECK_STR(requests[1].body, requests[1].body_len, "hello");
+	arena_destroy(&arena);
+}
+
+// Without Content-Length or Transfer-Encoding a request has no body (RFC 9112, 6.3), so it
+// is complete at the end of its head and whatever follows is the next request
+static void test_no_body(void)
+{
+	const char* request = "POST /form HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	Http_Request req = {0};
+	Arena arena = arena_create(0x1000);
+	CHECK_EQ(parse_incremental(request, 1, 0, &req, &arena), HTTP_SUCCESS);
+	CHECK_EQ(req.body_len, 0);
+
+	const char* buffer = "POST /a HTTP/1.1\r\nHost: localhost\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+	Http_Request requests[2];
+	size_t consumed;
+	uint8_t status;
+	CHECK_EQ(http_parse_requests(buffer, strlen(buffer), requests, 2, 0, &consumed, &status, &arena), 2);
+	CHECK_EQ(status, HTTP_SUCCESS);
+	CHECK_EQ(consumed, strlen(buffer));
+	CHECK_EQ(requests[0].body_len, 0);
+	CHECK_STR(requests[1].target, requests[1].target_len, "/b");
+	arena_destroy(&arena);
+}
+
+static void test_chunked(void)
+{
+	const char* request = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nHello \r\n6;last\r\nworld!\r\n0\r\nExpires: never\r\n\r\n";
+	Http_Request req = {0};
+	Arena arena = arena_create(0x1000);
+	CHECK_EQ(http_parse_request(request, strlen(request), &req, &arena), HTTP_SUCCESS);
+	CHECK_STR(req.body, req.body_len, "Hello world!");
+	CHECK_EQ(req.trailers.count, 1);
+	arena_destroy(&arena);
+}
+
+static void test_response(void)
+{
+	const char* buffer = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 12\r\n\r\nHello world!";
+	Http_Response res = {0};
+	Arena arena = arena_create(0x1000);
+	CHECK_EQ(http_parse_response(buffer, strlen(buffer), &res, 0, &arena), HTTP_SUCCESS);
+	CHECK_EQ(res.status_code, 200);
+	CHECK_STR(res.body, res.body_len, "Hello world!");
+	arena_destroy(&arena);
+}
+
+static void test_header_ids(void)
+{
+	const char* request = "GET / HTTP/1.1\r\nhost: localhost\r\nUSER-AGENT: FakeFox\r\nX-Request-Id: 42\r\nX-Custom: 1\r\n\r\n";
+	Http_Request req = {0};
+	Arena arena = arena_create(0x1000);
+	CHECK_EQ(http_parse_request(request, strlen(request), &req, &arena), HTTP_SUCCESS);
+
+	Http_Header host = http_request_header(&req, HTTP_HEADER_HOST);
+	CHECK_STR(host.value, host.value_len, "localhost");
+	CHECK_EQ(host.id, HTTP_HEADER_HOST);
+	Http_Header agent = http_request_header(&req, HTTP_HEADER_USER_AGENT);
+	CHECK_STR(agent.value, agent.value_len, "FakeFox");
+	Http_Header request_id = http_request_header(&req, HTTP_HEADER_X_REQUEST_ID);
+	CHECK_STR(request_id.value, request_id.value_len, "42");
+	CHECK(http_request_header(&req, HTTP_HEADER_COOKIE).name == NULL);
+	CHECK_EQ(http_header_at(&req.headers, 3).id, HTTP_HEADER_UNKNOWN);
+
+	CHECK_EQ(http_header_id("content-LENGTH", 14), HTTP_HEADER_CONTENT_LENGTH);
+	CHECK_EQ(http_header_id("Content-Lengths", 15), HTTP_HEADER_UNKNOWN);
+	CHECK(strcmp(http_header_name(HTTP_HEADER_USER_AGENT), "user-agent") == 0);
+	arena_destroy(&arena);
+}
+
+static void test_method_ids(void)
+{
+	const char* methods[] = { "GET", "HEAD", "POST", "PUT", "DELETE", "CONNECT", "OPTIONS", "TRACE", "PATCH" };
+	for (int i = 0; i < (int)(sizeof(methods) / sizeof(methods[0])); ++i) {
+		Http_Method method = http_method_id(methods[i], strlen(methods[i]));
+		CHECK_EQ(method, HTTP_METHOD_GET + i);
+		CHECK(strcmp(http_method_name(method), methods[i]) == 0);
+	}
+
+	// Case-sensitive, and prefixes or longer names of a known method are extension methods
+	CHECK_EQ(http_method_id("get", 3), HTTP_METHOD_OTHER);
+	CHECK_EQ(http_method_id("GE", 2), HTTP_METHOD_OTHER);
+	CHECK_EQ(http_method_id("PATCHES", 7), HTTP_METHOD_OTHER);
+	CHECK_EQ(http_method_id("OPTIONSX", 8), HTTP_METHOD_OTHER);
+
+	const char* request = "PURGE /a HTTP/1.1\r\n\r\n";
+	Http_Request req = {0};
+	Arena arena = arena_create(0x1000);
+	CHECK_EQ(http_parse_request(request, strlen(request), &req, &arena), HTTP_SUCCESS);
+	CHECK_EQ(req.method_id, HTTP_METHOD_OTHER);
+	CHECK_STR(req.method, req.method_len, "PURGE");
+	arena_destroy(&arena);
+}
+
+// Twelve headers, so the last four spill past the inline spans into the arena
+static void test_header_spans(void)
+{
+	const char* request = "GET / HTTP/1.1\r\nH1: a\r\nH2: b\r\nH3: c\r\nH4: d\r\nH5: e\r\nH6: f\r\nH7: g\r\n"
+		"H8: h\r\nH9: i\r\nH10: j\r\nH11: k\r\nHost: l\r\n\r\n";
+	for (uint8_t flags = 0; flags <= HTTP_PARSE_ZERO_COPY; ++flags) {
+		Http_Request req = {0};
+		Arena arena = arena_create(0x1000);
+		CHECK_EQ(parse_incremental(request, 5, flags, &req, &arena), HTTP_SUCCESS);
+		CHECK_EQ(req.headers.count, 12);
+		CHECK(req.headers.count > HTTP_INLINE_HEADERS);
+		for (size_t i = 0; i < 11; ++i) {
+			char name[4];
+			int name_len = snprintf(name, sizeof(name), "H%zu", i + 1);
+			Http_Header header = http_header_at(&req.headers, i);
+			CHECK(header.name_len == (size_t)name_len && memcmp(header.name, name, name_len) == 0);
+			CHECK(header.value_len == 1 && header.value[0] == (char)('a' + i));
+			// The arena copy NUL terminates names and values in place
+			if (!(flags & HTTP_PARSE_ZERO_COPY))
+				CHECK(header.name[header.name_len] == '\0' && header.value[header.value_len] == '\0');
+		}
+		Http_Header host = http_request_header(&req, HTTP_HEADER_HOST);
+		CHECK_STR(host.name, host.name_len, "Host");
+		CHECK_STR(host.value, host.value_len, "l");
+		CHECK(http_header_at(&req.headers, 12).name == NULL);
+		arena_destroy(&arena);
+	}
+}
+
+// OWS on either side of a value is not part of it, nor are the CRLF and whatever follows
+static void test_header_ows(void)
+{
+	const char* request = "GET / HTTP/1.1\r\nHost: a  \r\nX-Tab:\tb c\t \r\nX-Empty:   \r\n\r\n";
+	for (uint8_t flags = 0; flags <= HTTP_PARSE_ZERO_COPY; ++flags) {
+		for (size_t chunk = 1; chunk < 0x100; chunk *= 7) {
+			Http_Request req = {0};
+			Arena arena = arena_create(0x1000);
+			CHECK_EQ(parse_incremental(request, chunk, flags, &req, &arena), HTTP_SUCCESS);
+			CHECK_EQ(req.headers.count, 3);
+			Http_Header host = http_request_header(&req, HTTP_HEADER_HOST);
+			CHECK_STR(host.value, host.value_len, "a");
+			Http_Header tab = http_header_at(&req.headers, 1);
+			CHECK_STR(tab.value, tab.value_len, "b c");
+			CHECK_EQ(http_header_at(&req.headers, 2).value_len, 0);
+			if (!(flags & HTTP_PARSE_ZERO_COPY))
+				CHECK(host.value[host.value_len] == '\0' && tab.value[tab.value_len] == '\0');
+			arena_destroy(&arena);
+		}
+	}
+}
+
+static uint8_t parse_limited(const char* request, size_t chunk_size, const Http_Limits* limits)
+{
+	static char buffer[0x4000];
+	size_t len = strlen(request);
+	size_t received = 0;
+
+	Http_Request req = {0};
+	Http_Parser parser;
+	http_parser_init(&parser, 0);
+	parser.limits = limits;
+	Arena arena = arena_create(0x1000);
+	uint8_t status = HTTP_END_OF_CONTENT;
+	while (status == HTTP_END_OF_CONTENT && received < len) {
+		size_t chunk = len - received < chunk_size ? len - received : chunk_size;
+		memcpy(buffer + received, request + received, chunk);
+		received += chunk;
+		status = http_parser_execute(&parser, buffer, received, &req, &arena);
+	}
+	arena_destroy(&arena);
+	return status;
+}
+
+static void test_limits(void)
+{
+	Http_Limits limits = { .max_head = 128, .max_headers = 4, .max_header_size = 32, .max_body = 16 };
+	// Whole and a byte at a time, a limit must hold however the request arrives
+	for (size_t chunk = 1; chunk <= 0x1000; chunk *= 0x1000) {
+		CHECK_EQ(parse_limited("POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 16\r\n\r\n0123456789abcdef", chunk, &limits), HTTP_SUCCESS);
+		CHECK_EQ(parse_limited("GET / HTTP/1.1\r\nX-Header-One: 0123456789abcd\r\nX-Header-Two: 0123456789abcd\r\n"
+			"X-Header-Six: 0123456789abcd\r\nX-Header-Ten: 0123456789abcd\r\n\r\n", chunk, &limits), HTTP_HEADERS_TOO_LARGE);
+		CHECK_EQ(parse_limited("GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\nD: 4\r\nE: 5\r\n\r\n", chunk, &limits), HTTP_TOO_MANY_HEADERS);
+		CHECK_EQ(parse_limited("GET / HTTP/1.1\r\nUser-Agent: a-rather-long-user-agent-string\r\n\r\n", chunk, &limits), HTTP_HEADER_FIELD_TOO_LARGE);
+		CHECK_EQ(parse_limited("POST / HTTP/1.1\r\nContent-Length: 17\r\n\r\n0123456789abcdefg", chunk, &limits), HTTP_BODY_TOO_LARGE);
+		CHECK_EQ(parse_limited("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n10\r\n0123456789abcdef\r\n1\r\ng\r\n0\r\n\r\n", chunk, &limits), HTTP_BODY_TOO_LARGE);
+	}
+
+	// 0 turns a limit off
+	Http_Limits unlimited = {0};
+	CHECK_EQ(parse_limited("GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\nD: 4\r\nE: 5\r\nUser-Agent: a-rather-long-user-agent-string\r\n\r\n", 7, &unlimited), HTTP_SUCCESS);
+}
+
+// A keep-alive connection parses request after request into one Http_Request and
+// arena, once the first request has sized them nothing more should be allocated
+static void test_request_reset(void)
+{
+	const char* request = "POST / HTTP/1.1\r\nH1: a\r\nH2: b\r\nH3: c\r\nH4: d\r\nH5: e\r\nH6: f\r\nH7: g\r\n"
+		"H8: h\r\nH9: i\r\nH10: j\r\nContent-Length: 5\r\n\r\nhello";
+	Http_Request req = {0};
+	Http_Parser parser;
+	Arena arena = arena_create(0x1000);
+	size_t used = 0;
+	size_t blocks = 0;
+
+	for (int i = 0; i < 1000; ++i) {
+		http_parser_init(&parser, 0);
+		CHECK_EQ(http_parser_execute(&parser, request, strlen(request), &req, &arena), HTTP_SUCCESS);
+		CHECK_EQ(req.headers.count, 11);
+		CHECK_STR(req.body, req.body_len, "hello");
+
+		size_t count = 0;
+		for (Arena_Block* block = arena.first; block != NULL; block = block->next)
+			count++;
+		if (i == 0) {
+			used = arena_used(&arena);
+			blocks = count;
+		}
+		else if (arena_used(&arena) != used || count != blocks) {
+			CHECK_EQ(arena_used(&arena), used);
+			CHECK_EQ(count, blocks);
+			break;
+		}
+
+		http_request_reset(&req, &arena);
+		CHECK_EQ(req.headers.count, 0);
+		CHECK_EQ(req.body_len, 0);
+		CHECK(req.headers.capacity >= 11 - HTTP_INLINE_HEADERS);
+	}
+
+	// A failed request leaves nothing behind either
+	const char* bad = "GET / HTTP/1.1\r\nH1: a\r\nBad Header\r\n\r\n";
+	http_parser_init(&parser, 0);
+	CHECK_EQ(http_parser_execute(&parser, bad, strlen(bad), &req, &arena), HTTP_COLON_EXPECTED);
+	http_request_reset(&req, &arena);
+	http_parser_init(&parser, 0);
+	CHECK_EQ(http_parser_execute(&parser, request, strlen(request), &req, &arena), HTTP_SUCCESS);
+	CHECK_EQ(arena_used(&arena), used);
+	arena_destroy(&arena);
+}
+
+// A limit that ends inside the indexed blocks must stop the parse at the limit, whether
+// the head arrives whole and is indexed or a byte at a time, at every kernel level
+static void test_index_limits(void)
+{
+	static char request[0x400];
+	int len = sprintf(request, "GET / HTTP/1.1\r\nX-Long: ");
+	memset(request + len, 'a', 300);
+	len += 300;
+	len += sprintf(request + len, "\r\nHost: a\r\n\r\n");
+
+	Http_Limits limits = http_default_limits;
+	limits.max_header_size = 40;
+	uint8_t level = http_scan_get_level();
+	for (uint8_t scan_level = HTTP_SCAN_SCALAR; scan_level <= level; ++scan_level) {
+		http_scan_set_level(scan_level);
+		for (size_t chunk = 1; chunk <= 0x1000; chunk *= 0x1000) {
+			Http_Request req = {0};
+			Http_Parser parser;
+			http_parser_init(&parser, 0);
+			parser.limits = &limits;
+			Arena arena = arena_create(0x1000);
+			uint8_t status = HTTP_END_OF_CONTENT;
+			for (size_t received = chunk; status == HTTP_END_OF_CONTENT; received += chunk) {
+				if (received > (size_t)len)
+					received = len;
+				status = http_parser_execute(&parser, request, received, &req, &arena);
+				if (received == (size_t)len)
+					break;
+			}
+			CHECK_EQ(status, HTTP_HEADER_FIELD_TOO_LARGE);
+			CHECK_EQ(parser.pos, strlen("GET / HTTP/1.1\r\n") + 40);
+			arena_destroy(&arena);
+		}
+	}
+	http_scan_set_level(level);
+
+	CHECK_EQ(parse_limited(request, 0x1000, &limits), HTTP_HEADER_FIELD_TOO_LARGE);
+	limits.max_header_size = 0;
+	limits.max_head = 100;
+	CHECK_EQ(parse_limited(request, 0x1000, &limits), HTTP_HEADERS_TOO_LARGE);
+}
+
+// Only the head is indexed, not the body after it nor what follows in the buffer
+static void test_index_head_only(void)
+{
+	static char buffer[0x1000];
+	size_t len = 0;
+	for (int i = 0; i < 3; ++i) {
+		len += sprintf(buffer + len, "POST /%d HTTP/1.1\r\nContent-Length: 550\r\n\r\n", i);
+		for (int j = 0; j < 100; ++j)
+			len += sprintf(buffer + len, "%s", j % 2 ? "body\r\n" : "\r\n\r\nx");
+	}
+
+	Http_Request requests[3];
+	Arena arena = arena_create(0x1000);
+	size_t consumed;
+	uint8_t status;
+	CHECK_EQ(http_parse_requests(buffer, len, requests, 3, 0, &consumed, &status, &arena), 3);
+	CHECK_EQ(status, HTTP_SUCCESS);
+	CHECK_EQ(consumed, len);
+	CHECK_STR(requests[2].target, requests[2].target_len, "/2");
+
+	Http_Request req = {0};
+	Http_Parser parser;
+	http_parser_init(&parser, 0);
+	CHECK_EQ(http_parser_execute(&parser, buffer, len, &req, &arena), HTTP_SUCCESS);
+	if (http_scan_get_level() > HTTP_SCAN_SCALAR) {
+		CHECK(parser.index.complete);
+		CHECK_EQ(parser.index.blocks, 1);
+	}
+	arena_destroy(&arena);
+}
+
+int main(void)
+{
+	RUN_TEST(test_simple_request);
+	RUN_TEST(test_incremental);
+	RUN_TEST(test_pipeline);
+	RUN_TEST(test_no_body);
+	RUN_TEST(test_chunked);
+	RUN_TEST(test_response);
+	RUN_TEST(test_header_ids);
+	RUN_TEST(test_method_ids);
+	RUN_TEST(test_header_spans);
+	RUN_TEST(test_header_ows);
+	RUN_TEST(test_limits);
+	RUN_TEST(test_request_reset);
+	RUN_TEST(test_index_limits);
+	RUN_TEST(test_index_head_only);
+	return test_failures != 0;
+}
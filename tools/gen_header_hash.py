@@ -0,0 +1,71 @@
+# Generates the perfect hash table of http_headers.c for the header registry below.
+# The hash only looks at the length and three characters of a name, lowercased:
+#   h = (len * A + first * B + second_to_last * C + last * D) & (HTTP_HEADER_TABLE_SIZE - 1)
+# Run it after changing the registry and paste its output over the table.
+
+import random
+import sys
+
+HEADERS = [
+    "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language", "Accept-Ranges",
+    "Access-Control-Allow-Credentials", "Access-Control-Allow-Headers", "Access-Control-Allow-Methods",
+    "Access-Control-Allow-Origin", "Access-Control-Expose-Headers", "Access-Control-Max-Age",
+    "Access-Control-Request-Headers", "Access-Control-Request-Method", "Age", "Allow", "Authorization",
+    "Cache-Control", "Connection", "Content-Disposition", "Content-Encoding", "Content-Language",
+    "Content-Length", "Content-Location", "Content-Range", "Content-Type", "Cookie", "Date", "ETag",
+    "Expect", "Expires", "Forwarded", "From", "Host", "If-Match", "If-Modified-Since", "If-None-Match",
+    "If-Range", "If-Unmodified-Since", "Keep-Alive", "Last-Modified", "Link", "Location", "Max-Forwards",
+    "Origin", "Pragma", "Proxy-Authenticate", "Proxy-Authorization", "Range", "Referer", "Retry-After",
+    "Sec-Fetch-Dest", "Sec-Fetch-Mode", "Sec-Fetch-Site", "Sec-Fetch-User", "Server", "Set-Cookie",
+    "Strict-Transport-Security", "TE", "Trailer", "Transfer-Encoding", "Upgrade",
+    "Upgrade-Insecure-Requests", "User-Agent", "Vary", "Via", "Warning", "WWW-Authenticate",
+    "X-Forwarded-For", "X-Forwarded-Host", "X-Forwarded-Proto", "X-Real-IP", "X-Request-ID",
+]
+
+TABLE_SIZE = 256
+
+
+def key(name):
+    s = name.lower().encode()
+    return len(s), s[0], s[-2], s[-1]
+
+
+def find_constants():
+    keys = [key(h) for h in HEADERS]
+    rng = random.Random(1)
+    while True:
+        a, b, c, d = (rng.randrange(1, 256) for _ in range(4))
+        slots = {(n * a + f * b + m * c + l * d) & (TABLE_SIZE - 1) for n, f, m, l in keys}
+        if len(slots) == len(keys):
+            return a, b, c, d
+
+
+def enum_name(name):
+    return "HTTP_HEADER_" + name.upper().replace("-", "_")
+
+
+def main():
+    a, b, c, d = find_constants()
+    table = [0] * TABLE_SIZE
+    for i, h in enumerate(HEADERS):
+        n, f, m, l = key(h)
+        table[(n * a + f * b + m * c + l * d) & (TABLE_SIZE - 1)] = i + 1
+
+    out = sys.stdout
+    out.write("// Generated by tools/gen_header_hash.py\n")
+    out.write("#define HTTP_HEADER_HASH_A %d\n#define HTTP_HEADER_HASH_B %d\n" % (a, b))
+    out.write("#define HTTP_HEADER_HASH_C %d\n#define HTTP_HEADER_HASH_D %d\n\n" % (c, d))
+    out.write("static const uint8_t http_header_slots[HTTP_HEADER_TABLE_SIZE] = \n{\n")
+    for row in range(0, TABLE_SIZE, 16):
+        out.write("\t" + ", ".join("%2d" % v for v in table[row:row + 16]) + ",\n")
+    out.write("};\n\n")
+    out.write("static const char* http_header_names[HTTP_HEADER_ID_COUNT] = \n{\n\tNULL,\n")
+    for h in HEADERS:
+        out.write('\t"%s",\n' % h.lower())
+    out.write("};\n\n---- enum ----\n")
+    for h in HEADERS:
+        out.write("\t%s,\n" % enum_name(h))
+
+
+if __name__ == "__main__":
+    main()